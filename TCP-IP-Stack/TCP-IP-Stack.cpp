@@ -72,6 +72,21 @@ std::vector<uint8_t> create_ra_packet() {
     return ra_packet;
 }
 
+std::vector<uint8_t> create_ip_fragment(uint16_t id, uint32_t offset, uint16_t payload_length, bool more_fragments, uint8_t header_length = 20) {
+    std::vector<uint8_t> fragment(header_length + payload_length, 0xAB);
+    uint16_t total_length = static_cast<uint16_t>(fragment.size());
+    uint16_t flags_fragment_offset = static_cast<uint16_t>((more_fragments ? 0x2000 : 0) | (offset / 8));
+    fragment[0] = static_cast<uint8_t>(0x40 | (header_length / 4));
+    fragment[2] = total_length >> 8;
+    fragment[3] = total_length & 0xFF;
+    fragment[4] = id >> 8;
+    fragment[5] = id & 0xFF;
+    fragment[6] = flags_fragment_offset >> 8;
+    fragment[7] = flags_fragment_offset & 0xFF;
+    fragment[9] = 17; // UDP
+    return fragment;
+}
+
 int main() {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -179,6 +194,26 @@ int main() {
         std::cout << "Failed to parse ICMP Echo Reply" << std::endl;
     }
 
+    // 测试IP分片重组：重叠分片、超出末尾的分片和超长数据报都必须被拒绝
+    TimerWheel timers;
+    IPReassembler reassembler(timers);
+    std::vector<uint8_t> reassembled;
+    bool reassembly_ok = true;
+    reassembler.add_fragment(create_ip_fragment(1, 0, 1000, true), reassembled);
+    reassembler.add_fragment(create_ip_fragment(1, 504, 8, true), reassembled);
+    reassembly_ok &= !reassembler.add_fragment(create_ip_fragment(1, 8, 8, false), reassembled);
+    reassembler.add_fragment(create_ip_fragment(2, 8, 8, false), reassembled);
+    reassembly_ok &= !reassembler.add_fragment(create_ip_fragment(2, 504, 8, true), reassembled);
+    reassembly_ok &= !reassembler.add_fragment(create_ip_fragment(2, 16, 8, false), reassembled);
+    reassembly_ok &= reassembler.add_fragment(create_ip_fragment(2, 0, 8, true), reassembled) && reassembled.size() == 20 + 16;
+    reassembler.add_fragment(create_ip_fragment(3, 65512, 3, false), reassembled);
+    reassembler.add_fragment(create_ip_fragment(3, 0, 65448, true, 60), reassembled);
+    reassembly_ok &= !reassembler.add_fragment(create_ip_fragment(3, 65448, 64, true), reassembled);
+    reassembler.add_fragment(create_ip_fragment(4, 0, 16, true), reassembled);
+    reassembler.add_fragment(create_ip_fragment(4, 8, 16, true), reassembled);
+    reassembly_ok &= reassembler.add_fragment(create_ip_fragment(4, 24, 8, false), reassembled) && reassembled.size() == 20 + 32;
+    std::cout << (reassembly_ok ? "IP fragment reassembly checks passed" : "IP fragment reassembly checks failed") << std::endl;
+
     cleanup_network();  // 清理网络（Windows）
 
 #ifdef _WIN32
@@ -7,6 +7,7 @@
 #include <vector>
 #include <cstring>
 #include <iostream>
+#include "NeighborCache.h"
 
 class ARP {
 public:
@@ -75,4 +76,7 @@ bool ARP::parse_arp_packet(const std::vector<uint8_t>& packet, uint32_t& src_ip,
     return true;
 }
 
+// IPv4 neighbor cache; entries expire 60 s after the last update (RFC 1122 2.3.2.1)
+typedef NeighborCache<uint32_t> ARPCache;
+
 #endif // ARP_H
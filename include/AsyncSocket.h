@@ -0,0 +1,250 @@
+#ifndef ASYNCSOCKET_H
+#define ASYNCSOCKET_H
+
+#include "Task.h"
+#include "EventPoller.h"
+#include "Socket.h"
+#include "TCPConnection.h"
+#include "TCPListener.h"
+#include <coroutine>
+#include <memory>
+#include <vector>
+
+// Resumes coroutines suspended on stack sockets. Each Async* wrapper
+// registers its object with the loop's EventPoller once, edge-triggered,
+// and keeps at most one suspended reader and one writer. An operation that
+// can complete at once never suspends; otherwise the coroutine waits for the
+// next rising edge of the events it needs. Suspending allocates nothing:
+// the awaiter lives in the coroutine frame, and frames come from the
+// FramePool.
+//
+// The loop never blocks. Whoever drives the stack (link receive, timers)
+// calls poll() after each round to run the coroutines that can proceed;
+// Stack::run() does so for a loop attached with set_event_loop().
+class EventLoop {
+public:
+    // Suspended coroutines of one registered object
+    struct Waiters {
+        EventPoller::Source* source = nullptr;
+        std::coroutine_handle<> reader; // receive and accept
+        std::coroutine_handle<> writer; // send and connect
+    };
+
+    EventLoop() : resumed(0) {}
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Runs the task until it first suspends; it then continues from poll()
+    // and frees itself when it returns.
+    void spawn(Task task) {
+        task.detach().resume();
+    }
+
+    // Resumes the coroutines whose objects became ready; returns how many.
+    size_t poll(size_t max_events = 256) {
+        poller.wait(events, max_events);
+        size_t count = 0;
+        for (const auto& event : events) {
+            if (!event.user_data) {
+                continue; // removed by a coroutine resumed earlier in this round
+            }
+            Waiters& waiters = *static_cast<Waiters*>(event.user_data);
+            // Such a coroutine may also have consumed the readiness
+            uint32_t current = waiters.source->get_events();
+            std::coroutine_handle<> reader = (current & (EventPoller::READABLE | EventPoller::ACCEPTABLE | FAILED)) ? std::exchange(waiters.reader, nullptr) : nullptr;
+            std::coroutine_handle<> writer = (current & (EventPoller::WRITABLE | FAILED)) ? std::exchange(waiters.writer, nullptr) : nullptr;
+            if (reader) {
+                reader.resume();
+                count++;
+            }
+            if (writer) {
+                writer.resume();
+                count++;
+            }
+        }
+        events.clear();
+        resumed += count;
+        return count;
+    }
+
+    void add(Waiters& waiters, EventPoller::Source& source) {
+        waiters.source = &source;
+        poller.add(source, EventPoller::READABLE | EventPoller::WRITABLE | EventPoller::ACCEPTABLE | EventPoller::EDGE_TRIGGERED, &waiters);
+    }
+
+    void remove(Waiters& waiters) {
+        poller.remove(*waiters.source);
+        for (auto& event : events) {
+            if (event.user_data == &waiters) {
+                event.user_data = nullptr;
+            }
+        }
+    }
+
+    // Suspends the awaiting coroutine until the object has one of `wanted`
+    // (or failed), then returns complete(). `writer` selects the waiter slot.
+    template <typename Complete>
+    struct Operation {
+        Waiters& waiters;
+        uint32_t wanted;
+        bool writer;
+        Complete complete;
+
+        bool await_ready() const {
+            return (waiters.source->get_events() & (wanted | FAILED)) != 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            (writer ? waiters.writer : waiters.reader) = handle;
+        }
+
+        auto await_resume() {
+            return complete();
+        }
+    };
+
+    template <typename Complete>
+    static Operation<Complete> operation(Waiters& waiters, uint32_t wanted, bool writer, Complete complete) {
+        return Operation<Complete>{ waiters, wanted, writer, std::move(complete) };
+    }
+
+    EventPoller& get_poller() {
+        return poller;
+    }
+
+    uint64_t get_resumed() const {
+        return resumed;
+    }
+
+private:
+    // Failures complete any operation, which then reports them
+    static constexpr uint32_t FAILED = EventPoller::FAILURE | EventPoller::HANGUP;
+
+    EventPoller poller;
+    std::vector<EventPoller::Event> events;
+    uint64_t resumed;
+};
+
+// Awaitable operations on a UDP Socket.
+class AsyncSocket {
+public:
+    AsyncSocket(Socket& socket, EventLoop& loop) : socket(socket), loop(loop) {
+        loop.add(waiters, socket.get_poll_source());
+    }
+
+    ~AsyncSocket() {
+        loop.remove(waiters);
+    }
+
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+    // Waits for datagrams and appends up to `max_datagrams`; returns the
+    // count, 0 only if the socket is unusable.
+    auto recv(std::vector<UDPDatagram>& datagrams, size_t max_datagrams = 64) {
+        return EventLoop::operation(waiters, EventPoller::READABLE, false, [this, &datagrams, max_datagrams] {
+            return socket.recvmmsg(datagrams, max_datagrams);
+        });
+    }
+
+    // Returns the number of datagrams sent.
+    auto send(const std::vector<UDPDatagram>& datagrams) {
+        return EventLoop::operation(waiters, EventPoller::WRITABLE, true, [this, &datagrams] {
+            return socket.sendmmsg(datagrams);
+        });
+    }
+
+    Socket& get_socket() {
+        return socket;
+    }
+
+private:
+    Socket& socket;
+    EventLoop& loop;
+    EventLoop::Waiters waiters;
+};
+
+// Awaitable operations on a TCPConnection.
+class AsyncConnection {
+public:
+    AsyncConnection(TCPConnection& connection, EventLoop& loop) : connection(connection), loop(loop) {
+        loop.add(waiters, connection.get_poll_source());
+    }
+
+    ~AsyncConnection() {
+        loop.remove(waiters);
+    }
+
+    AsyncConnection(const AsyncConnection&) = delete;
+    AsyncConnection& operator=(const AsyncConnection&) = delete;
+
+    // Sends the SYN and waits for the handshake; true once established.
+    auto connect() {
+        connection.send_syn();
+        return EventLoop::operation(waiters, EventPoller::WRITABLE, true, [this] {
+            return connection.get_state() == TCPConnection::ESTABLISHED;
+        });
+    }
+
+    // Waits for data or the peer's FIN; returns the bytes moved to `data`,
+    // 0 at end of stream or when the connection failed.
+    auto recv(std::vector<uint8_t>& data) {
+        return EventLoop::operation(waiters, EventPoller::READABLE, false, [this, &data] {
+            return connection.receive(data);
+        });
+    }
+
+    // Waits for send buffer space, then queues `data`; false if the
+    // connection can no longer send.
+    auto send(const std::vector<uint8_t>& data) {
+        return EventLoop::operation(waiters, EventPoller::WRITABLE, true, [this, &data] {
+            if (!(connection.poll_events() & EventPoller::WRITABLE)) {
+                return false;
+            }
+            connection.send(data);
+            return true;
+        });
+    }
+
+    TCPConnection& get_connection() {
+        return connection;
+    }
+
+private:
+    TCPConnection& connection;
+    EventLoop& loop;
+    EventLoop::Waiters waiters;
+};
+
+// Awaitable accept on a TCPListener.
+class AsyncListener {
+public:
+    AsyncListener(TCPListener& listener, EventLoop& loop) : listener(listener), loop(loop) {
+        loop.add(waiters, listener.get_poll_source());
+    }
+
+    ~AsyncListener() {
+        loop.remove(waiters);
+    }
+
+    AsyncListener(const AsyncListener&) = delete;
+    AsyncListener& operator=(const AsyncListener&) = delete;
+
+    auto accept() {
+        return EventLoop::operation(waiters, EventPoller::ACCEPTABLE, false, [this] {
+            return listener.accept();
+        });
+    }
+
+    TCPListener& get_listener() {
+        return listener;
+    }
+
+private:
+    TCPListener& listener;
+    EventLoop& loop;
+    EventLoop::Waiters waiters;
+};
+
+#endif // ASYNCSOCKET_H
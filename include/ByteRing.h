@@ -0,0 +1,124 @@
+#ifndef BYTERING_H
+#define BYTERING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Growable circular byte buffer for connection send and receive queues.
+// Bytes are appended at the back and consumed from the front in O(1), and
+// any range can be read by offset. Storage is allocated on the first append
+// and kept when the buffer drains, so a busy stream does not free and
+// reallocate it on every read; the owner calls release() once the buffer
+// has stayed idle, and the capacity is remembered for the next allocation.
+class ByteRing {
+public:
+    ByteRing() : capacity(0), head(0), count(0) {}
+
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    // Bytes of storage currently allocated
+    size_t allocated() const {
+        return storage ? capacity : 0;
+    }
+
+    uint8_t operator[](size_t offset) const {
+        return storage[(head + offset) & (capacity - 1)];
+    }
+
+    void append(const uint8_t* data, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        reserve(count + length);
+        size_t tail = (head + count) & (capacity - 1);
+        size_t first = std::min(length, capacity - tail);
+        memcpy(&storage[tail], data, first);
+        memcpy(&storage[0], data + first, length - first);
+        count += static_cast<uint32_t>(length);
+    }
+
+    void append(const std::vector<uint8_t>& data) {
+        append(data.data(), data.size());
+    }
+
+    // Copies `length` bytes starting `offset` bytes past the front.
+    void copy(size_t offset, size_t length, uint8_t* dest) const {
+        if (length == 0) {
+            return;
+        }
+        size_t start = (head + offset) & (capacity - 1);
+        size_t first = std::min(length, capacity - start);
+        memcpy(dest, &storage[start], first);
+        memcpy(dest + first, &storage[0], length - first);
+    }
+
+    std::vector<uint8_t> copy(size_t offset, size_t length) const {
+        std::vector<uint8_t> data(length);
+        copy(offset, length, data.data());
+        return data;
+    }
+
+    // Drops `length` bytes from the front.
+    void consume(size_t length) {
+        if (length >= count) {
+            clear();
+            return;
+        }
+        head = static_cast<uint32_t>((head + length) & (capacity - 1));
+        count -= static_cast<uint32_t>(length);
+    }
+
+    // Drops every byte; the storage is kept.
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    // Frees the storage of an empty buffer.
+    void release() {
+        if (count == 0) {
+            storage.reset();
+            head = 0;
+        }
+    }
+
+private:
+    static constexpr size_t MIN_CAPACITY = 4096;
+
+    std::unique_ptr<uint8_t[]> storage;
+    uint32_t capacity; // power of two; kept while storage is released
+    uint32_t head;
+    uint32_t count;
+
+    void reserve(size_t needed) {
+        if (storage && needed <= capacity) {
+            return;
+        }
+        size_t new_capacity = capacity != 0 ? capacity : MIN_CAPACITY;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        std::unique_ptr<uint8_t[]> grown(new uint8_t[new_capacity]);
+        if (storage) {
+            copy(0, count, grown.get());
+        }
+        storage = std::move(grown);
+        capacity = static_cast<uint32_t>(new_capacity);
+        head = 0;
+    }
+};
+
+#endif // BYTERING_H
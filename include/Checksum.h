@@ -0,0 +1,99 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Internet checksum (RFC 1071). Partial sums are 32-bit accumulations of
+// big-endian 16-bit words, so they can be chained across buffers that start
+// at even offsets and folded once at the end.
+class Checksum {
+public:
+    // Adds `length` bytes at `data` to the partial sum `sum`.
+    static uint32_t add(const uint8_t* data, size_t length, uint32_t sum = 0) {
+        // One's complement addition is byte order independent (RFC 1071 2(B)):
+        // sum native 64-bit words and swap the folded result once.
+        uint64_t wide = 0;
+        while (length >= 8) {
+            uint64_t word;
+            memcpy(&word, data, 8);
+            wide += word;
+            wide += (wide < word); // end-around carry
+            data += 8;
+            length -= 8;
+        }
+        uint32_t tail = 0;
+        while (length >= 2) {
+            uint16_t word;
+            memcpy(&word, data, 2);
+            tail += word;
+            data += 2;
+            length -= 2;
+        }
+        if (length) {
+            uint8_t last[2] = { data[0], 0 };
+            uint16_t word;
+            memcpy(&word, last, 2);
+            tail += word;
+        }
+        wide = (wide & 0xFFFFFFFF) + (wide >> 32);
+        wide += tail;
+        while (wide >> 32) {
+            wide = (wide & 0xFFFFFFFF) + (wide >> 32); // a fold can carry again
+        }
+        uint16_t native = static_cast<uint16_t>(~fold(static_cast<uint32_t>(wide)));
+        uint16_t big_endian = is_little_endian() ? static_cast<uint16_t>((native << 8) | (native >> 8)) : native;
+        return sum + big_endian;
+    }
+
+    static uint32_t add16(uint16_t value, uint32_t sum = 0) {
+        return sum + value;
+    }
+
+    static uint32_t add32(uint32_t value, uint32_t sum = 0) {
+        return sum + (value >> 16) + (value & 0xFFFF);
+    }
+
+    // Folds a partial sum and returns the checksum field value (host order).
+    static uint16_t fold(uint32_t sum) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        return static_cast<uint16_t>(~sum);
+    }
+
+    // TCP/UDP pseudo-header; addresses are the four wire bytes of the IP header.
+    static uint32_t pseudo_header(const uint8_t* src, const uint8_t* dest, uint8_t protocol, uint16_t length) {
+        uint32_t sum = 0;
+        sum += (src[0] << 8) | src[1];
+        sum += (src[2] << 8) | src[3];
+        sum += (dest[0] << 8) | dest[1];
+        sum += (dest[2] << 8) | dest[3];
+        sum += protocol;
+        sum += length;
+        return sum;
+    }
+
+    // Incremental update when a 16-bit field changes (RFC 1624 eqn. 3).
+    static uint16_t update16(uint16_t checksum, uint16_t old_value, uint16_t new_value) {
+        uint32_t sum = static_cast<uint16_t>(~checksum);
+        sum += static_cast<uint16_t>(~old_value);
+        sum += new_value;
+        return fold(sum);
+    }
+
+    static uint16_t update32(uint16_t checksum, uint32_t old_value, uint32_t new_value) {
+        checksum = update16(checksum, static_cast<uint16_t>(old_value >> 16), static_cast<uint16_t>(new_value >> 16));
+        return update16(checksum, static_cast<uint16_t>(old_value & 0xFFFF), static_cast<uint16_t>(new_value & 0xFFFF));
+    }
+
+private:
+    static bool is_little_endian() {
+        const uint16_t probe = 1;
+        uint8_t first;
+        memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+};
+
+#endif // CHECKSUM_H
@@ -0,0 +1,63 @@
+#ifndef COMPLETIONQUEUE_H
+#define COMPLETIONQUEUE_H
+
+#include "EventPoller.h"
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// A zero-copy send the stack no longer references. `delivered` is set when
+// the data was acknowledged (TCP) or handed to the link (UDP), and clear
+// when it was released unsent, e.g. because the connection went away.
+struct SendCompletion {
+    uint64_t id;
+    bool delivered;
+};
+
+// Where the stack reports finished zero-copy sends, in completion order
+// (like the MSG_ZEROCOPY error queue). The application may reuse a buffer
+// once its id comes back. Several sockets can share one queue.
+class CompletionQueue {
+public:
+    CompletionQueue() {}
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    void push(uint64_t id, bool delivered) {
+        completions.push_back({ id, delivered });
+        if (completions.size() == 1) {
+            readiness.set_events(EventPoller::READABLE);
+        }
+    }
+
+    // Moves up to `max_completions` completions to `out`; returns the count.
+    size_t poll(std::vector<SendCompletion>& out, size_t max_completions) {
+        size_t count = 0;
+        while (count < max_completions && !completions.empty()) {
+            out.push_back(completions.front());
+            completions.pop_front();
+            count++;
+        }
+        if (count > 0 && completions.empty()) {
+            readiness.set_events(0);
+        }
+        return count;
+    }
+
+    size_t size() const {
+        return completions.size();
+    }
+
+    // READABLE while completions are waiting.
+    EventPoller::Source& get_poll_source() {
+        return readiness;
+    }
+
+private:
+    std::deque<SendCompletion> completions;
+    EventPoller::Source readiness;
+};
+
+#endif // COMPLETIONQUEUE_H
@@ -0,0 +1,600 @@
+#ifndef CONGESTIONCONTROL_H
+#define CONGESTIONCONTROL_H
+
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+// Congestion control interface used by TCPConnection.
+// All windows are in bytes, pacing rates in bytes per second (0 = unpaced).
+class CongestionControl {
+public:
+    enum Algorithm {
+        NEW_RENO,   // RFC 5681/6582, loss-based
+        CUBIC,      // RFC 9438, loss-based, for high-BDP links
+        BBR,        // model-based (bottleneck bandwidth + min RTT), tolerant of random loss
+        DCTCP       // RFC 8257, ECN-proportional, for datacenter fabrics
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~CongestionControl() {}
+
+    // New data was cumulatively acknowledged.
+    virtual void on_ack(uint32_t acked_bytes, uint32_t bytes_in_flight, Clock::time_point now) = 0;
+    // Loss detected by fast retransmit / RACK; called once per recovery episode.
+    virtual void on_loss(uint32_t bytes_in_flight, Clock::time_point now) = 0;
+    // Retransmission timeout fired.
+    virtual void on_timeout(uint32_t bytes_in_flight, Clock::time_point now) = 0;
+    // Recovery begun by on_loss() or on_timeout() ended: the data outstanding
+    // when it began has been cumulatively acknowledged.
+    virtual void on_recovery_end(Clock::time_point) {}
+    virtual void on_rtt_sample(std::chrono::microseconds rtt, Clock::time_point now) = 0;
+    // Every ACK of new data on an ECN connection; `ece` if it echoed a CE mark.
+    virtual void on_ecn_ack(uint32_t, bool, Clock::time_point) {}
+    // ECN congestion signal (RFC 3168 6.1.2), at most once per window. By
+    // default the window is reduced as for a loss.
+    virtual void on_ecn(uint32_t bytes_in_flight, Clock::time_point now) {
+        on_loss(bytes_in_flight, now);
+    }
+
+    virtual uint64_t pacing_rate() const = 0;
+    virtual uint32_t cwnd() const = 0;
+    virtual const char* name() const = 0;
+
+    static std::unique_ptr<CongestionControl> create(Algorithm algorithm, uint32_t mss);
+
+protected:
+    static const uint32_t INITIAL_WINDOW_SEGMENTS = 10; // RFC 6928
+
+    static uint64_t rate_from_window(double window_bytes, std::chrono::microseconds rtt, double gain) {
+        if (rtt.count() <= 0) {
+            return 0;
+        }
+        return static_cast<uint64_t>(gain * window_bytes * 1000000.0 / static_cast<double>(rtt.count()));
+    }
+};
+
+class NewRenoCongestionControl : public CongestionControl {
+public:
+    explicit NewRenoCongestionControl(uint32_t mss)
+        : mss(mss),
+        congestion_window(INITIAL_WINDOW_SEGMENTS * mss),
+        ssthresh(UINT32_MAX),
+        bytes_acked(0),
+        in_recovery(false),
+        srtt(0) {}
+
+    // During fast recovery the window stays at ssthresh. The connection
+    // retransmits the next hole on each partial ACK (RFC 6582 3.2 step 5),
+    // and with no window inflation there is nothing to deflate; the full
+    // ACK ends recovery with the window already at ssthresh.
+    void on_ack(uint32_t acked_bytes, uint32_t, Clock::time_point) override {
+        if (in_recovery) {
+            return;
+        }
+        if (congestion_window < ssthresh) {
+            // Slow start with appropriate byte counting (RFC 3465, L = 2 * SMSS)
+            congestion_window += std::min(acked_bytes, 2 * mss);
+        }
+        else {
+            bytes_acked += acked_bytes;
+            if (bytes_acked >= congestion_window) {
+                bytes_acked -= congestion_window;
+                congestion_window += mss;
+            }
+        }
+    }
+
+    void on_loss(uint32_t bytes_in_flight, Clock::time_point) override {
+        reduce(bytes_in_flight);
+        in_recovery = true;
+    }
+
+    // An ECE halves the window like a loss, but no retransmissions follow
+    void on_ecn(uint32_t bytes_in_flight, Clock::time_point) override {
+        reduce(bytes_in_flight);
+    }
+
+    // Slow start from one segment; growth resumes at once
+    void on_timeout(uint32_t bytes_in_flight, Clock::time_point) override {
+        reduce(bytes_in_flight);
+        congestion_window = mss;
+        in_recovery = false;
+    }
+
+    void on_recovery_end(Clock::time_point) override {
+        in_recovery = false;
+    }
+
+    void on_rtt_sample(std::chrono::microseconds rtt, Clock::time_point) override {
+        srtt = srtt.count() == 0 ? rtt : (srtt * 7 + rtt) / 8;
+    }
+
+    uint64_t pacing_rate() const override {
+        // Same gains as Linux: 200% in slow start, 120% in congestion avoidance
+        return rate_from_window(congestion_window, srtt, congestion_window < ssthresh ? 2.0 : 1.2);
+    }
+
+    uint32_t cwnd() const override {
+        return congestion_window;
+    }
+
+    const char* name() const override {
+        return "newreno";
+    }
+
+private:
+    uint32_t mss;
+    uint32_t congestion_window;
+    uint32_t ssthresh;
+    uint32_t bytes_acked;
+    bool in_recovery; // fast recovery, between on_loss() and on_recovery_end()
+    std::chrono::microseconds srtt;
+
+    void reduce(uint32_t bytes_in_flight) {
+        ssthresh = std::max(bytes_in_flight / 2, 2 * mss);
+        congestion_window = ssthresh;
+        bytes_acked = 0;
+    }
+};
+
+class CubicCongestionControl : public CongestionControl {
+public:
+    explicit CubicCongestionControl(uint32_t mss)
+        : mss(mss),
+        cwnd_segments(INITIAL_WINDOW_SEGMENTS),
+        ssthresh_segments(1e9),
+        w_max(0),
+        w_est(0),
+        k(0),
+        epoch_valid(false),
+        in_recovery(false),
+        min_rtt(0),
+        srtt(0) {}
+
+    // As in NewReno, the window holds at ssthresh during fast recovery; a
+    // new congestion avoidance epoch starts with the first ACK after it.
+    void on_ack(uint32_t acked_bytes, uint32_t, Clock::time_point now) override {
+        if (in_recovery) {
+            return;
+        }
+        double acked_segments = static_cast<double>(acked_bytes) / mss;
+
+        if (cwnd_segments < ssthresh_segments) {
+            cwnd_segments += std::min(acked_segments, 2.0);
+            return;
+        }
+
+        if (!epoch_valid) {
+            epoch_valid = true;
+            epoch_start = now;
+            w_est = cwnd_segments;
+            k = cwnd_segments < w_max ? std::cbrt((w_max - cwnd_segments) / C) : 0.0;
+            if (cwnd_segments >= w_max) {
+                w_max = cwnd_segments;
+            }
+        }
+
+        double t = std::chrono::duration<double>(now - epoch_start).count()
+            + std::chrono::duration<double>(min_rtt).count();
+        double target = C * std::pow(t - k, 3.0) + w_max;
+        target = std::min(target, cwnd_segments * 1.5);
+
+        // Reno-friendly region (RFC 9438 section 4.3)
+        w_est += ALPHA * acked_segments / cwnd_segments;
+
+        if (target < w_est) {
+            cwnd_segments = w_est;
+        }
+        else if (target > cwnd_segments) {
+            cwnd_segments += (target - cwnd_segments) / cwnd_segments * acked_segments;
+        }
+    }
+
+    void on_loss(uint32_t, Clock::time_point) override {
+        reduce();
+        cwnd_segments = ssthresh_segments;
+        in_recovery = true;
+    }
+
+    void on_timeout(uint32_t, Clock::time_point) override {
+        reduce();
+        cwnd_segments = 1;
+        in_recovery = false;
+    }
+
+    void on_recovery_end(Clock::time_point) override {
+        in_recovery = false;
+    }
+
+    void on_rtt_sample(std::chrono::microseconds rtt, Clock::time_point) override {
+        if (min_rtt.count() == 0 || rtt < min_rtt) {
+            min_rtt = rtt;
+        }
+        srtt = srtt.count() == 0 ? rtt : (srtt * 7 + rtt) / 8;
+    }
+
+    uint64_t pacing_rate() const override {
+        return rate_from_window(cwnd_segments * mss, srtt, cwnd_segments < ssthresh_segments ? 2.0 : 1.2);
+    }
+
+    uint32_t cwnd() const override {
+        return static_cast<uint32_t>(std::max(cwnd_segments, 1.0) * mss);
+    }
+
+    const char* name() const override {
+        return "cubic";
+    }
+
+private:
+    static constexpr double C = 0.4;
+    static constexpr double BETA = 0.7;
+    static constexpr double ALPHA = 3.0 * (1.0 - BETA) / (1.0 + BETA);
+
+    uint32_t mss;
+    double cwnd_segments;
+    double ssthresh_segments;
+    double w_max;
+    double w_est;
+    double k;
+    bool epoch_valid;
+    bool in_recovery; // fast recovery, between on_loss() and on_recovery_end()
+    Clock::time_point epoch_start;
+    std::chrono::microseconds min_rtt;
+    std::chrono::microseconds srtt;
+
+    void reduce() {
+        epoch_valid = false;
+        // Fast convergence: release bandwidth sooner when W_max is shrinking
+        if (cwnd_segments < w_max) {
+            w_max = cwnd_segments * (1.0 + BETA) / 2.0;
+        }
+        else {
+            w_max = cwnd_segments;
+        }
+        ssthresh_segments = std::max(cwnd_segments * BETA, 2.0);
+    }
+};
+
+// BBR-style controller: estimates bottleneck bandwidth (windowed max of the
+// ACK delivery rate over ~10 round trips) and round-trip propagation time
+// (windowed min RTT over 10 s), then paces at gain * BtlBw and caps the
+// window at gain * BDP. Isolated losses do not shrink the model.
+class BBRCongestionControl : public CongestionControl {
+public:
+    explicit BBRCongestionControl(uint32_t mss)
+        : mss(mss),
+        mode(STARTUP),
+        congestion_window(INITIAL_WINDOW_SEGMENTS * mss),
+        prior_cwnd(0),
+        rtprop(0),
+        delivered(0),
+        round_delivered(0),
+        round_count(0),
+        full_bw(0),
+        full_bw_rounds(0),
+        filled_pipe(false),
+        in_recovery(false),
+        cycle_index(0),
+        pacing_gain(HIGH_GAIN),
+        cwnd_gain(HIGH_GAIN) {
+        std::fill(bw_samples, bw_samples + BW_WINDOW_ROUNDS, 0);
+    }
+
+    void on_ack(uint32_t acked_bytes, uint32_t bytes_in_flight, Clock::time_point now) override {
+        delivered += acked_bytes;
+        if (round_start == Clock::time_point()) {
+            round_start = now;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - round_start);
+        auto round_length = std::max(rtprop, std::chrono::microseconds(1000));
+        if (elapsed >= round_length) {
+            end_round(elapsed);
+            round_start = now;
+            round_delivered = delivered;
+        }
+
+        update_mode(bytes_in_flight, now);
+        update_cwnd(acked_bytes, bytes_in_flight);
+    }
+
+    // Packet conservation until recovery ends; the model is kept, and the
+    // window from before the loss is restored afterwards.
+    void on_loss(uint32_t bytes_in_flight, Clock::time_point) override {
+        save_cwnd();
+        in_recovery = true;
+        congestion_window = std::max(bytes_in_flight, MIN_CWND_SEGMENTS * mss);
+    }
+
+    void on_timeout(uint32_t, Clock::time_point) override {
+        save_cwnd();
+        in_recovery = true;
+        congestion_window = mss;
+    }
+
+    void on_recovery_end(Clock::time_point) override {
+        in_recovery = false;
+        if (mode != PROBE_RTT) {
+            congestion_window = std::max(congestion_window, prior_cwnd);
+        }
+    }
+
+    void on_rtt_sample(std::chrono::microseconds rtt, Clock::time_point now) override {
+        bool expired = rtprop.count() != 0 && now - rtprop_stamp > RTPROP_WINDOW;
+        if (rtprop.count() == 0 || rtt <= rtprop || expired) {
+            rtprop = rtt;
+            rtprop_stamp = now;
+        }
+        if (expired && mode != PROBE_RTT) {
+            enter_probe_rtt(now);
+        }
+    }
+
+    uint64_t pacing_rate() const override {
+        uint64_t bw = btl_bw();
+        if (bw == 0) {
+            return rate_from_window(congestion_window, rtprop, pacing_gain);
+        }
+        return static_cast<uint64_t>(pacing_gain * bw);
+    }
+
+    uint32_t cwnd() const override {
+        return congestion_window;
+    }
+
+    const char* name() const override {
+        return "bbr";
+    }
+
+private:
+    enum Mode {
+        STARTUP,
+        DRAIN,
+        PROBE_BW,
+        PROBE_RTT
+    };
+
+    static constexpr double HIGH_GAIN = 2.885; // 2 / ln(2)
+    static constexpr double PROBE_BW_GAINS[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+    static const int BW_WINDOW_ROUNDS = 10;
+    static const uint32_t MIN_CWND_SEGMENTS = 4;
+    static constexpr std::chrono::seconds RTPROP_WINDOW{ 10 };
+    static constexpr std::chrono::milliseconds PROBE_RTT_DURATION{ 200 };
+
+    uint32_t mss;
+    Mode mode;
+    uint32_t congestion_window;
+    uint32_t prior_cwnd;
+    std::chrono::microseconds rtprop;
+    Clock::time_point rtprop_stamp;
+    Clock::time_point round_start;
+    Clock::time_point probe_rtt_done;
+    uint64_t delivered;
+    uint64_t round_delivered;
+    uint64_t round_count;
+    uint64_t bw_samples[BW_WINDOW_ROUNDS];
+    uint64_t full_bw;
+    int full_bw_rounds;
+    bool filled_pipe;
+    bool in_recovery;
+    int cycle_index;
+    double pacing_gain;
+    double cwnd_gain;
+
+    uint64_t btl_bw() const {
+        return *std::max_element(bw_samples, bw_samples + BW_WINDOW_ROUNDS);
+    }
+
+    uint32_t bdp() const {
+        return static_cast<uint32_t>(btl_bw() * static_cast<uint64_t>(rtprop.count()) / 1000000);
+    }
+
+    void end_round(std::chrono::microseconds elapsed) {
+        uint64_t rate = (delivered - round_delivered) * 1000000 / static_cast<uint64_t>(elapsed.count());
+        round_count++;
+        bw_samples[round_count % BW_WINDOW_ROUNDS] = rate;
+
+        if (mode == STARTUP) {
+            // Pipe is full once bandwidth stops growing by 25% for 3 rounds
+            if (btl_bw() >= full_bw + full_bw / 4) {
+                full_bw = btl_bw();
+                full_bw_rounds = 0;
+            }
+            else if (++full_bw_rounds >= 3) {
+                filled_pipe = true;
+                mode = DRAIN;
+                pacing_gain = 1.0 / HIGH_GAIN;
+                cwnd_gain = HIGH_GAIN;
+            }
+        }
+        else if (mode == PROBE_BW) {
+            cycle_index = (cycle_index + 1) % 8;
+            pacing_gain = PROBE_BW_GAINS[cycle_index];
+        }
+    }
+
+    void update_mode(uint32_t bytes_in_flight, Clock::time_point now) {
+        if (mode == DRAIN && bytes_in_flight <= bdp()) {
+            mode = PROBE_BW;
+            cycle_index = 2;
+            pacing_gain = PROBE_BW_GAINS[cycle_index];
+            cwnd_gain = 2.0;
+        }
+        else if (mode == PROBE_RTT && now >= probe_rtt_done) {
+            rtprop_stamp = now;
+            mode = filled_pipe ? PROBE_BW : STARTUP;
+            pacing_gain = mode == PROBE_BW ? 1.0 : HIGH_GAIN;
+            cwnd_gain = mode == PROBE_BW ? 2.0 : HIGH_GAIN;
+            if (!in_recovery) {
+                congestion_window = std::max(congestion_window, prior_cwnd); // else when recovery ends
+            }
+        }
+
+    }
+
+    void update_cwnd(uint32_t acked_bytes, uint32_t bytes_in_flight) {
+        if (mode == PROBE_RTT) {
+            congestion_window = MIN_CWND_SEGMENTS * mss;
+            return;
+        }
+        if (in_recovery) {
+            // Send one byte for each byte delivered
+            congestion_window = std::max(congestion_window, bytes_in_flight + acked_bytes);
+            return;
+        }
+
+        uint32_t target = std::max(static_cast<uint32_t>(cwnd_gain * bdp()), MIN_CWND_SEGMENTS * mss);
+        if (filled_pipe) {
+            congestion_window = std::min(congestion_window + acked_bytes, target);
+        }
+        else if (congestion_window < target || btl_bw() == 0) {
+            congestion_window += acked_bytes;
+        }
+    }
+
+    void enter_probe_rtt(Clock::time_point now) {
+        mode = PROBE_RTT;
+        pacing_gain = 1.0;
+        save_cwnd();
+        probe_rtt_done = now + PROBE_RTT_DURATION;
+    }
+
+    // The window to restore after recovery or PROBE_RTT; one saved during
+    // either is only raised, so it is not lost when the two overlap.
+    void save_cwnd() {
+        if (in_recovery || mode == PROBE_RTT) {
+            prior_cwnd = std::max(prior_cwnd, congestion_window);
+        }
+        else {
+            prior_cwnd = congestion_window;
+        }
+    }
+
+};
+
+// DCTCP (RFC 8257): Reno growth, but the response to ECN marks scales with
+// alpha, a moving average of the fraction of bytes acknowledged with ECE,
+// so a shallow switch queue that marks early costs a small cut instead of
+// a halving. Needs ECN on both ends and CE marking at a low threshold.
+class DCTCPCongestionControl : public CongestionControl {
+public:
+    explicit DCTCPCongestionControl(uint32_t mss)
+        : mss(mss),
+        congestion_window(INITIAL_WINDOW_SEGMENTS * mss),
+        ssthresh(UINT32_MAX),
+        bytes_acked(0),
+        alpha(1.0),
+        window_bytes(0),
+        window_marked(0),
+        in_recovery(false),
+        srtt(0) {}
+
+    // No growth during fast recovery, as in NewReno
+    void on_ack(uint32_t acked_bytes, uint32_t, Clock::time_point) override {
+        if (in_recovery) {
+            return;
+        }
+        if (congestion_window < ssthresh) {
+            congestion_window += std::min(acked_bytes, 2 * mss);
+        }
+        else {
+            bytes_acked += acked_bytes;
+            if (bytes_acked >= congestion_window) {
+                bytes_acked -= congestion_window;
+                congestion_window += mss;
+            }
+        }
+    }
+
+    // RFC 8257 3.3: one alpha update per observation window of about one RTT.
+    void on_ecn_ack(uint32_t acked_bytes, bool ece, Clock::time_point now) override {
+        window_bytes += acked_bytes;
+        if (ece) {
+            window_marked += acked_bytes;
+        }
+        if (window_start == Clock::time_point()) {
+            window_start = now;
+        }
+        if (srtt.count() != 0 && now - window_start >= srtt && window_bytes > 0) {
+            double fraction = static_cast<double>(window_marked) / static_cast<double>(window_bytes);
+            alpha = (1.0 - GAIN) * alpha + GAIN * fraction;
+            window_bytes = 0;
+            window_marked = 0;
+            window_start = now;
+        }
+    }
+
+    void on_ecn(uint32_t, Clock::time_point) override {
+        ssthresh = std::max(static_cast<uint32_t>(congestion_window * (1.0 - alpha / 2.0)), 2 * mss);
+        congestion_window = ssthresh;
+        bytes_acked = 0;
+    }
+
+    void on_loss(uint32_t bytes_in_flight, Clock::time_point) override {
+        ssthresh = std::max(bytes_in_flight / 2, 2 * mss);
+        congestion_window = ssthresh;
+        bytes_acked = 0;
+        in_recovery = true;
+    }
+
+    void on_timeout(uint32_t bytes_in_flight, Clock::time_point) override {
+        ssthresh = std::max(bytes_in_flight / 2, 2 * mss);
+        congestion_window = mss;
+        bytes_acked = 0;
+        in_recovery = false;
+    }
+
+    void on_recovery_end(Clock::time_point) override {
+        in_recovery = false;
+    }
+
+    void on_rtt_sample(std::chrono::microseconds rtt, Clock::time_point) override {
+        srtt = srtt.count() == 0 ? rtt : (srtt * 7 + rtt) / 8;
+    }
+
+    uint64_t pacing_rate() const override {
+        return rate_from_window(congestion_window, srtt, congestion_window < ssthresh ? 2.0 : 1.2);
+    }
+
+    uint32_t cwnd() const override {
+        return congestion_window;
+    }
+
+    const char* name() const override {
+        return "dctcp";
+    }
+
+    double get_alpha() const {
+        return alpha;
+    }
+
+private:
+    static constexpr double GAIN = 1.0 / 16; // g in RFC 8257
+
+    uint32_t mss;
+    uint32_t congestion_window;
+    uint32_t ssthresh;
+    uint32_t bytes_acked;
+    double alpha; // starts at 1: the first reaction is a full halving, as in Linux
+    uint64_t window_bytes;
+    uint64_t window_marked;
+    bool in_recovery; // fast recovery, between on_loss() and on_recovery_end()
+    Clock::time_point window_start;
+    std::chrono::microseconds srtt;
+};
+
+inline std::unique_ptr<CongestionControl> CongestionControl::create(Algorithm algorithm, uint32_t mss) {
+    switch (algorithm) {
+    case CUBIC: return std::unique_ptr<CongestionControl>(new CubicCongestionControl(mss));
+    case BBR: return std::unique_ptr<CongestionControl>(new BBRCongestionControl(mss));
+    case DCTCP: return std::unique_ptr<CongestionControl>(new DCTCPCongestionControl(mss));
+    case NEW_RENO:
+    default: return std::unique_ptr<CongestionControl>(new NewRenoCongestionControl(mss));
+    }
+}
+
+#endif // CONGESTIONCONTROL_H
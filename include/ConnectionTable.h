@@ -0,0 +1,449 @@
+#ifndef CONNECTIONTABLE_H
+#define CONNECTIONTABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONNECTIONTABLE_SSE2 1
+#endif
+
+// Connection 4-tuple, in the same byte order TCPConnection stores it
+// (addresses as given to the constructor, ports in host order).
+struct FlowKey {
+    uint32_t local_ip;
+    uint32_t remote_ip;
+    uint16_t local_port;
+    uint16_t remote_port;
+
+    FlowKey() : local_ip(0), remote_ip(0), local_port(0), remote_port(0) {}
+    FlowKey(uint32_t lip, uint16_t lport, uint32_t rip, uint16_t rport)
+        : local_ip(lip), remote_ip(rip), local_port(lport), remote_port(rport) {}
+
+    bool operator==(const FlowKey& other) const {
+        return local_ip == other.local_ip && remote_ip == other.remote_ip
+            && local_port == other.local_port && remote_port == other.remote_port;
+    }
+};
+
+// Local bind address of a listener; local_ip 0 is the wildcard (INADDR_ANY).
+struct ListenKey {
+    uint32_t local_ip;
+    uint16_t local_port;
+
+    ListenKey() : local_ip(0), local_port(0) {}
+    ListenKey(uint32_t lip, uint16_t lport) : local_ip(lip), local_port(lport) {}
+
+    bool operator==(const ListenKey& other) const {
+        return local_ip == other.local_ip && local_port == other.local_port;
+    }
+};
+
+struct FlowKeyHash {
+    uint64_t operator()(const FlowKey& key, uint64_t seed) const {
+        uint64_t a = (static_cast<uint64_t>(key.local_ip) << 32) | key.remote_ip;
+        uint64_t b = (static_cast<uint64_t>(key.local_port) << 16) | key.remote_port;
+        return mix(a ^ mix(b ^ seed));
+    }
+
+    uint64_t operator()(const ListenKey& key, uint64_t seed) const {
+        return mix(((static_cast<uint64_t>(key.local_ip) << 16) | key.local_port) ^ seed);
+    }
+
+    static uint64_t mix(uint64_t x) {
+        // splitmix64 finalizer
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+};
+
+// Open-addressing hash table of Value pointers in groups of 16 slots. Each
+// slot has a one-byte tag (7 hash bits) so a probe compares 16 tags with one
+// SSE2 instruction and touches keys only on a tag hit.
+//
+// Readers never lock: each group is guarded by a sequence counter, and tags
+// and keys are stored as relaxed atomic words so a read racing a writer is
+// discarded rather than undefined. Writers serialize on a mutex. A resize
+// that grows the table retires the old one until destruction, so a reader
+// never dereferences freed memory; a rehash that only drops tombstones
+// rebuilds into a spare table of the same size instead, which keeps memory
+// bounded under connection churn. Readers recheck a generation counter and
+// retry if the table they probed was rebuilt under them. Removing a key
+// does not destroy the Value, which its owner must keep alive until readers
+// are done with it.
+template <typename Key, typename Value, typename Hash = FlowKeyHash>
+class LockFreeHashTable {
+public:
+    explicit LockFreeHashTable(size_t initial_capacity = 1024) : spare(nullptr), generation(0), count(0) {
+        std::random_device rd;
+        seed = (static_cast<uint64_t>(rd()) << 32) | rd(); // defeats hash flooding
+        size_t groups = 1;
+        while (groups * GROUP_SIZE * 7 / 8 < initial_capacity) {
+            groups <<= 1;
+        }
+        tables.emplace_back(new Table(groups));
+        current.store(tables.back().get(), std::memory_order_release);
+    }
+
+    LockFreeHashTable(const LockFreeHashTable&) = delete;
+    LockFreeHashTable& operator=(const LockFreeHashTable&) = delete;
+
+    Value* find(const Key& key) const {
+        while (true) {
+            uint64_t observed = generation.load(std::memory_order_acquire);
+            const Table* table = current.load(std::memory_order_acquire);
+            Value* found = probe(*table, key);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (generation.load(std::memory_order_relaxed) == observed) {
+                return found;
+            }
+            // the table may have been rebuilt while we probed it
+        }
+    }
+
+    // Returns false if the key is already present.
+    bool insert(const Key& key, Value* value) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        Table* table = current.load(std::memory_order_relaxed);
+        if (locate(*table, key, nullptr, nullptr)) {
+            return false;
+        }
+        if ((table->used + 1) * 8 > table->capacity() * 7) {
+            table = rehash(count.load(std::memory_order_relaxed) + 1);
+        }
+        place(*table, key, value);
+        count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // With `expected` set, the key is erased only while it still maps to it.
+    bool erase(const Key& key, const Value* expected = nullptr) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        Table* table = current.load(std::memory_order_relaxed);
+        Group* group;
+        int slot;
+        if (!locate(*table, key, &group, &slot)) {
+            return false;
+        }
+        if (expected && group->values[slot].load(std::memory_order_relaxed) != expected) {
+            return false;
+        }
+        // A group that still has an empty slot has never been full, so no
+        // probe sequence continues past it and the slot can be emptied
+        // outright instead of left as a tombstone.
+        uint8_t mark = group->match(EMPTY) != 0 ? EMPTY : DELETED;
+        if (mark == EMPTY) {
+            table->used--;
+        }
+        begin_write(*group);
+        group->store_tag(slot, mark);
+        group->values[slot].store(nullptr, std::memory_order_relaxed);
+        end_write(*group);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return current.load(std::memory_order_acquire)->capacity();
+    }
+
+private:
+    static const size_t GROUP_SIZE = 16;
+    static const uint8_t EMPTY = 0x80;
+    static const uint8_t DELETED = 0xFE;
+    static const uint64_t EMPTY_TAGS = 0x8080808080808080ULL;
+    static const size_t KEY_WORDS = sizeof(Key) / sizeof(uint32_t);
+
+    static_assert(sizeof(Key) % sizeof(uint32_t) == 0, "keys are copied as 32-bit words");
+
+    struct Group {
+        Group() : version(0) {
+            clear();
+        }
+
+        // Slot i's tag is byte i % 8 of tag word i / 8.
+        alignas(16) std::atomic<uint64_t> tags[2];
+        std::atomic<uint32_t> version;
+        std::atomic<uint32_t> keys[GROUP_SIZE][KEY_WORDS];
+        std::atomic<Value*> values[GROUP_SIZE];
+
+        void clear() {
+            tags[0].store(EMPTY_TAGS, std::memory_order_relaxed);
+            tags[1].store(EMPTY_TAGS, std::memory_order_relaxed);
+            for (auto& value : values) {
+                value.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        uint8_t load_tag(size_t slot) const {
+            return static_cast<uint8_t>(tags[slot / 8].load(std::memory_order_relaxed) >> (slot % 8 * 8));
+        }
+
+        void store_tag(size_t slot, uint8_t tag) {
+            unsigned shift = static_cast<unsigned>(slot % 8 * 8);
+            uint64_t word = tags[slot / 8].load(std::memory_order_relaxed);
+            word = (word & ~(0xFFULL << shift)) | (static_cast<uint64_t>(tag) << shift);
+            tags[slot / 8].store(word, std::memory_order_relaxed);
+        }
+
+        Key load_key(size_t slot) const {
+            uint32_t words[KEY_WORDS];
+            for (size_t i = 0; i < KEY_WORDS; i++) {
+                words[i] = keys[slot][i].load(std::memory_order_relaxed);
+            }
+            Key key;
+            std::memcpy(&key, words, sizeof(key));
+            return key;
+        }
+
+        void store_key(size_t slot, const Key& key) {
+            uint32_t words[KEY_WORDS];
+            std::memcpy(words, &key, sizeof(key));
+            for (size_t i = 0; i < KEY_WORDS; i++) {
+                keys[slot][i].store(words[i], std::memory_order_relaxed);
+            }
+        }
+
+        uint32_t match(uint8_t tag) const {
+            uint64_t low = tags[0].load(std::memory_order_relaxed);
+            uint64_t high = tags[1].load(std::memory_order_relaxed);
+#ifdef CONNECTIONTABLE_SSE2
+            __m128i group = _mm_set_epi64x(static_cast<long long>(high), static_cast<long long>(low));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(tag)))));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < GROUP_SIZE; i++) {
+                uint64_t word = i < 8 ? low : high;
+                mask |= static_cast<uint32_t>(static_cast<uint8_t>(word >> (i % 8 * 8)) == tag) << i;
+            }
+            return mask;
+#endif
+        }
+    };
+
+    struct Table {
+        explicit Table(size_t groups_count) : group_mask(groups_count - 1), used(0), groups(new Group[groups_count]) {}
+        size_t capacity() const {
+            return (group_mask + 1) * GROUP_SIZE;
+        }
+        size_t group_mask;
+        size_t used; // full + deleted slots
+        std::unique_ptr<Group[]> groups;
+    };
+
+    std::atomic<Table*> current;
+    std::vector<std::unique_ptr<Table>> tables; // every table allocated, freed on destruction
+    Table* spare; // retired table of the current size, reused by the next rehash
+    std::atomic<uint64_t> generation; // bumped each time a table is published
+    std::mutex writer_mutex;
+    std::atomic<size_t> count;
+    uint64_t seed;
+    Hash hasher;
+
+    static void begin_write(Group& group) {
+        group.version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void end_write(Group& group) {
+        group.version.fetch_add(1, std::memory_order_release);
+    }
+
+    Value* probe(const Table& table, const Key& key) const {
+        uint64_t hash = hasher(key, seed);
+        uint8_t tag = static_cast<uint8_t>(hash & 0x7F);
+        size_t index = static_cast<size_t>(hash >> 7) & table.group_mask;
+
+        for (size_t step = 1; step <= table.group_mask + 1; step++) {
+            const Group& group = table.groups[index];
+            while (true) {
+                uint32_t version = group.version.load(std::memory_order_acquire);
+                if (version & 1) {
+                    continue; // writer in progress
+                }
+
+                Value* found = nullptr;
+                for (uint32_t matches = group.match(tag); matches != 0; matches &= matches - 1) {
+                    int slot = std::countr_zero(matches);
+                    if (group.load_key(slot) == key) {
+                        found = group.values[slot].load(std::memory_order_relaxed);
+                        break;
+                    }
+                }
+                bool has_empty = group.match(EMPTY) != 0;
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (group.version.load(std::memory_order_relaxed) != version) {
+                    continue; // raced with a writer, re-read the group
+                }
+                if (found || has_empty) {
+                    return found;
+                }
+                break;
+            }
+            index = (index + step) & table.group_mask; // triangular probing
+        }
+        return nullptr;
+    }
+
+    // Writer-side lookup; called with writer_mutex held.
+    bool locate(Table& table, const Key& key, Group** found_group, int* found_slot) {
+        uint64_t hash = hasher(key, seed);
+        uint8_t tag = static_cast<uint8_t>(hash & 0x7F);
+        size_t index = static_cast<size_t>(hash >> 7) & table.group_mask;
+
+        for (size_t step = 1; step <= table.group_mask + 1; step++) {
+            Group& group = table.groups[index];
+            for (uint32_t matches = group.match(tag); matches != 0; matches &= matches - 1) {
+                int slot = std::countr_zero(matches);
+                if (group.load_key(slot) == key) {
+                    if (found_group) {
+                        *found_group = &group;
+                        *found_slot = slot;
+                    }
+                    return true;
+                }
+            }
+            if (group.match(EMPTY) != 0) {
+                return false;
+            }
+            index = (index + step) & table.group_mask;
+        }
+        return false;
+    }
+
+    void place(Table& table, const Key& key, Value* value) {
+        uint64_t hash = hasher(key, seed);
+        uint8_t tag = static_cast<uint8_t>(hash & 0x7F);
+        size_t index = static_cast<size_t>(hash >> 7) & table.group_mask;
+
+        for (size_t step = 1;; step++) {
+            Group& group = table.groups[index];
+            uint32_t free_slots = group.match(EMPTY) | group.match(DELETED);
+            if (free_slots != 0) {
+                int slot = std::countr_zero(free_slots);
+                if (group.load_tag(slot) == EMPTY) {
+                    table.used++;
+                }
+                begin_write(group);
+                group.store_key(slot, key);
+                group.values[slot].store(value, std::memory_order_relaxed);
+                group.store_tag(slot, tag);
+                end_write(group);
+                return;
+            }
+            index = (index + step) & table.group_mask;
+        }
+    }
+
+    // Rebuilds the table for `needed` live entries without tombstones and
+    // publishes it. Only a table that grows is newly kept; otherwise the
+    // spare of the same size is cleared and reused, and the table being
+    // replaced becomes the next spare.
+    Table* rehash(size_t needed) {
+        Table* old_table = current.load(std::memory_order_relaxed);
+        size_t groups = old_table->group_mask + 1;
+        while (groups * GROUP_SIZE * 7 / 16 < needed) {
+            groups <<= 1;
+        }
+
+        bool grows = groups != old_table->group_mask + 1;
+        Table* table = grows ? nullptr : spare;
+        if (table) {
+            // Readers still probing it from before it was retired see the
+            // generation move and retry.
+            for (size_t g = 0; g <= table->group_mask; g++) {
+                begin_write(table->groups[g]);
+                table->groups[g].clear();
+                end_write(table->groups[g]);
+            }
+            table->used = 0;
+        }
+        else {
+            tables.emplace_back(new Table(groups));
+            table = tables.back().get();
+        }
+
+        for (size_t g = 0; g <= old_table->group_mask; g++) {
+            Group& group = old_table->groups[g];
+            for (size_t slot = 0; slot < GROUP_SIZE; slot++) {
+                if (!(group.load_tag(slot) & 0x80)) {
+                    place(*table, group.load_key(slot), group.values[slot].load(std::memory_order_relaxed));
+                }
+            }
+        }
+
+        current.store(table, std::memory_order_release);
+        generation.fetch_add(1, std::memory_order_release);
+        spare = grows ? nullptr : old_table;
+        return table;
+    }
+};
+
+// Demultiplexes incoming TCP segments: fully specified 4-tuples first, then
+// listeners bound to the exact local address, then wildcard listeners.
+template <typename Connection, typename Listener = Connection>
+class ConnectionTable {
+public:
+    explicit ConnectionTable(size_t expected_connections = 1024)
+        : connections(expected_connections), listeners(64) {}
+
+    bool add_connection(const FlowKey& key, Connection* connection) {
+        return connections.insert(key, connection);
+    }
+
+    bool remove_connection(const FlowKey& key, const Connection* connection = nullptr) {
+        return connections.erase(key, connection);
+    }
+
+    bool add_listener(uint32_t local_ip, uint16_t local_port, Listener* listener) {
+        return listeners.insert(ListenKey(local_ip, local_port), listener);
+    }
+
+    bool remove_listener(uint32_t local_ip, uint16_t local_port) {
+        return listeners.erase(ListenKey(local_ip, local_port));
+    }
+
+    // Lookup for a segment received from (src_ip, src_port) to (dest_ip, dest_port).
+    Connection* find_connection(uint32_t src_ip, uint16_t src_port, uint32_t dest_ip, uint16_t dest_port) const {
+        return connections.find(FlowKey(dest_ip, dest_port, src_ip, src_port));
+    }
+
+    Listener* find_listener(uint32_t dest_ip, uint16_t dest_port) const {
+        Listener* listener = listeners.find(ListenKey(dest_ip, dest_port));
+        if (!listener) {
+            listener = listeners.find(ListenKey(0, dest_port));
+        }
+        return listener;
+    }
+
+    size_t connection_count() const {
+        return connections.size();
+    }
+
+    size_t listener_count() const {
+        return listeners.size();
+    }
+
+private:
+    LockFreeHashTable<FlowKey, Connection> connections;
+    LockFreeHashTable<ListenKey, Listener> listeners;
+};
+
+#endif // CONNECTIONTABLE_H
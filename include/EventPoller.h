@@ -0,0 +1,219 @@
+#ifndef EVENTPOLLER_H
+#define EVENTPOLLER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Readiness multiplexer for stack sockets (the epoll model). Sockets,
+// connections and listeners embed an EventPoller::Source and publish their
+// readiness through set_events() whenever it changes. The poller keeps the
+// sources whose readiness matches their interest on an intrusive ready
+// list, so registration, removal and each readiness change are O(1) and
+// wait() costs O(ready) however many sources are registered.
+//
+// Level-triggered sources stay on the ready list while they are ready and
+// every wait() reports them, round robin when more are ready than fit.
+// Edge-triggered sources (EDGE_TRIGGERED in the interest mask) are reported
+// once per rising edge of an event they asked for; as with EPOLLET the
+// caller must drain a source until it is no longer ready. FAILURE and
+// HANGUP are reported whether or not they were asked for.
+//
+// wait() never blocks: the stack runs on the caller's thread, which polls
+// between rounds of receive and timer processing.
+class EventPoller {
+public:
+    static constexpr uint32_t READABLE = 0x01;   // data, a datagram or end of stream to read
+    static constexpr uint32_t WRITABLE = 0x02;   // room in the send buffer
+    static constexpr uint32_t ACCEPTABLE = 0x04; // a listener has a connection to accept
+    static constexpr uint32_t FAILURE = 0x08;    // an error, like EPOLLERR
+    static constexpr uint32_t HANGUP = 0x10;     // closed in both directions, like EPOLLHUP
+    static constexpr uint32_t EDGE_TRIGGERED = 0x80000000;
+
+    struct Event {
+        uint32_t events;
+        void* user_data;
+    };
+
+    class Source {
+    public:
+        Source() : next(nullptr), pprev(nullptr), poller(nullptr), user_data(nullptr), interest(0), events(0) {}
+        ~Source() {
+            if (poller) {
+                poller->remove(*this);
+            }
+        }
+
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+
+        // Publishes the owner's current readiness, a mask of the events above.
+        void set_events(uint32_t current) {
+            uint32_t rising = current & ~events;
+            events = current;
+            if (poller) {
+                poller->update(*this, rising);
+            }
+        }
+
+        uint32_t get_events() const {
+            return events;
+        }
+
+        bool is_registered() const {
+            return poller != nullptr;
+        }
+
+    private:
+        friend class EventPoller;
+        Source* next;  // on the poller's ready or idle list
+        Source** pprev;
+        EventPoller* poller;
+        void* user_data;
+        uint32_t interest; // requested events, EDGE_TRIGGERED and ON_READY_LIST
+        uint32_t events;
+    };
+
+    EventPoller() : ready_head(nullptr), ready_tail(&ready_head), idle_head(nullptr), registered(0), ready(0) {}
+
+    ~EventPoller() {
+        while (ready_head) {
+            remove(*ready_head);
+        }
+        while (idle_head) {
+            remove(*idle_head);
+        }
+    }
+
+    EventPoller(const EventPoller&) = delete;
+    EventPoller& operator=(const EventPoller&) = delete;
+
+    // Registers `source` for `interest` (events, optionally EDGE_TRIGGERED);
+    // `user_data` comes back with its events. A source that is already ready
+    // is reported by the next wait(). False if it is registered already.
+    bool add(Source& source, uint32_t interest, void* user_data) {
+        if (source.poller) {
+            return false;
+        }
+        source.poller = this;
+        source.interest = interest & ~ON_READY_LIST;
+        source.user_data = user_data;
+        link(source, false);
+        registered++;
+        update(source, source.events);
+        return true;
+    }
+
+    // Changes the interest and user data; like EPOLL_CTL_MOD this also re-arms
+    // an edge-triggered source that is still ready.
+    bool modify(Source& source, uint32_t interest, void* user_data) {
+        if (source.poller != this) {
+            return false;
+        }
+        source.interest = (interest & ~ON_READY_LIST) | (source.interest & ON_READY_LIST);
+        source.user_data = user_data;
+        update(source, source.events);
+        return true;
+    }
+
+    void remove(Source& source) {
+        if (source.poller != this) {
+            return;
+        }
+        unlink(source);
+        source.poller = nullptr;
+        registered--;
+    }
+
+    // Appends up to `max_events` ready sources to `events`; returns the
+    // count. Each source is reported at most once per call.
+    size_t wait(std::vector<Event>& events, size_t max_events) {
+        size_t count = 0;
+        size_t candidates = ready;
+        while (count < max_events && candidates-- > 0) {
+            Source& source = *ready_head;
+            events.push_back({ source.events & reported(source.interest), source.user_data });
+            count++;
+            unlink(source);
+            // Level-triggered: back of the line while still ready; edge-triggered: until the next edge
+            link(source, !(source.interest & EDGE_TRIGGERED));
+        }
+        return count;
+    }
+
+    // Registered sources
+    size_t size() const {
+        return registered;
+    }
+
+    size_t ready_count() const {
+        return ready;
+    }
+
+private:
+    static constexpr uint32_t ON_READY_LIST = 0x40000000;
+
+    Source* ready_head; // FIFO, so level-triggered sources take turns
+    Source** ready_tail;
+    Source* idle_head;  // registered sources with nothing to report
+    size_t registered;
+    size_t ready;
+
+    static uint32_t reported(uint32_t interest) {
+        return (interest & (READABLE | WRITABLE | ACCEPTABLE)) | FAILURE | HANGUP;
+    }
+
+    // Moves the source between the lists after its events or interest changed;
+    // `rising` holds events that just became set.
+    void update(Source& source, uint32_t rising) {
+        uint32_t mask = reported(source.interest);
+        bool queued = (source.interest & ON_READY_LIST) != 0;
+        if ((source.events & mask) == 0) {
+            if (queued) {
+                unlink(source);
+                link(source, false);
+            }
+        }
+        else if (!queued && (!(source.interest & EDGE_TRIGGERED) || (rising & mask) != 0)) {
+            unlink(source);
+            link(source, true);
+        }
+    }
+
+    void link(Source& source, bool on_ready_list) {
+        if (on_ready_list) {
+            source.next = nullptr;
+            source.pprev = ready_tail;
+            *ready_tail = &source;
+            ready_tail = &source.next;
+            source.interest |= ON_READY_LIST;
+            ready++;
+        }
+        else {
+            source.next = idle_head;
+            source.pprev = &idle_head;
+            if (idle_head) {
+                idle_head->pprev = &source.next;
+            }
+            idle_head = &source;
+        }
+    }
+
+    void unlink(Source& source) {
+        if (source.next) {
+            source.next->pprev = source.pprev;
+        }
+        else if (source.interest & ON_READY_LIST) {
+            ready_tail = source.pprev;
+        }
+        *source.pprev = source.next;
+        if (source.interest & ON_READY_LIST) {
+            source.interest &= ~ON_READY_LIST;
+            ready--;
+        }
+        source.next = nullptr;
+        source.pprev = nullptr;
+    }
+};
+
+#endif // EVENTPOLLER_H
@@ -0,0 +1,65 @@
+#ifndef FASTOPENCACHE_H
+#define FASTOPENCACHE_H
+
+#include "IPAddress.h"
+#include "TCP.h"
+#include "SipHash.h"
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+// Client side of TCP Fast Open (RFC 7413 4.1.3): the cookie each server
+// handed out, with the MSS it announced so data in the next SYN fits in one
+// segment. Shared by every connection of a client; TCPConnection looks it
+// up when sending a SYN and stores what the SYN-ACK returns.
+class FastOpenCache {
+public:
+    struct Entry {
+        uint8_t cookie[TCPOptions::MAX_FAST_OPEN_COOKIE];
+        uint8_t cookie_length;
+        uint16_t mss;
+    };
+
+    explicit FastOpenCache(size_t max_entries = 1024) : max_entries(max_entries) {}
+
+    // Inserts or replaces the cookie for `server`. When the cache is full an
+    // arbitrary entry makes room; that server just asks for a new cookie.
+    void store(const IPAddress& server, const uint8_t* cookie, uint8_t cookie_length, uint16_t mss) {
+        if (cookie_length < TCPOptions::MIN_FAST_OPEN_COOKIE || cookie_length > TCPOptions::MAX_FAST_OPEN_COOKIE) {
+            return;
+        }
+        if (entries.size() >= max_entries && entries.find(server) == entries.end()) {
+            entries.erase(entries.begin());
+        }
+        Entry& entry = entries[server];
+        std::memcpy(entry.cookie, cookie, cookie_length);
+        entry.cookie_length = cookie_length;
+        entry.mss = mss;
+    }
+
+    const Entry* lookup(const IPAddress& server) const {
+        auto it = entries.find(server);
+        return it != entries.end() ? &it->second : nullptr;
+    }
+
+    void remove(const IPAddress& server) {
+        entries.erase(server);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    struct AddressHash {
+        size_t operator()(const IPAddress& address) const {
+            static const SipHash hash;
+            return static_cast<size_t>(hash.hash(address.get_address(), 16));
+        }
+    };
+
+    size_t max_entries;
+    std::unordered_map<IPAddress, Entry, AddressHash> entries;
+};
+
+#endif // FASTOPENCACHE_H
@@ -5,9 +5,21 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+#include "TimerWheel.h"
 
 class IPPacket {
 public:
+    // ECN codepoints in the low two bits of dscp_ecn (RFC 3168 5)
+    static const uint8_t ECN_NOT_ECT = 0x00;
+    static const uint8_t ECN_ECT1 = 0x01;
+    static const uint8_t ECN_ECT0 = 0x02;
+    static const uint8_t ECN_CE = 0x03;
+    static const uint8_t ECN_MASK = 0x03;
+
     uint8_t version_ihl;
     uint8_t dscp_ecn;
     uint16_t total_length;
@@ -35,6 +47,13 @@ public:
         header_checksum = calculate_checksum();
     }
 
+    // Sets the DSCP/ECN byte and refreshes the header checksum.
+    void set_dscp_ecn(uint8_t value) {
+        dscp_ecn = value;
+        header_checksum = 0;
+        header_checksum = calculate_checksum();
+    }
+
     std::vector<uint8_t> serialize() const {
         std::vector<uint8_t> buffer(20 + payload.size());
         buffer[0] = version_ihl;
@@ -64,7 +83,9 @@ public:
         uint32_t dest = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
         std::vector<uint8_t> payload(data.begin() + 20, data.end());
 
-        return IPPacket(protocol, ntohl(src), ntohl(dest), payload);
+        IPPacket packet(protocol, ntohl(src), ntohl(dest), payload);
+        packet.set_dscp_ecn(dscp_ecn);
+        return packet;
     }
 
     static std::vector<uint8_t> create_ip_header(uint32_t src_ip, uint32_t dest_ip, uint16_t length) {
@@ -160,5 +181,167 @@ public:
 };
 
 
+// Collects IPv4 fragments until the datagram is complete. Incomplete
+// datagrams are dropped when their reassembly timer expires (RFC 791).
+// At most `max_datagrams` are held at a time (64 of up to 64 KB each, the
+// 4 MB Linux allows by default); fragments of further datagrams are dropped.
+class IPReassembler {
+public:
+    static constexpr uint32_t MAX_DATAGRAM_SIZE = 65535;
+
+    explicit IPReassembler(TimerWheel& timers, std::chrono::seconds timeout = std::chrono::seconds(30), size_t max_datagrams = 64)
+        : timer_wheel(timers), reassembly_timeout(timeout), max_datagrams(max_datagrams) {}
+
+    // Returns true and fills `packet` once all fragments of a datagram have arrived.
+    // Unfragmented packets are passed through unchanged.
+    bool add_fragment(const std::vector<uint8_t>& fragment, std::vector<uint8_t>& packet) {
+        if (fragment.size() < 20) {
+            return false;
+        }
+        size_t header_length = (fragment[0] & 0x0F) * 4;
+        size_t total_length = (fragment[2] << 8) | fragment[3];
+        if (header_length < 20 || total_length < header_length || total_length > fragment.size()) {
+            return false;
+        }
+
+        uint16_t flags_fragment_offset = (fragment[6] << 8) | fragment[7];
+        bool more_fragments = (flags_fragment_offset & 0x2000) != 0;
+        uint32_t offset = (flags_fragment_offset & 0x1FFF) * 8;
+        if (!more_fragments && offset == 0) {
+            packet = fragment;
+            return true;
+        }
+        uint32_t payload_length = static_cast<uint32_t>(total_length - header_length);
+        uint32_t end = offset + payload_length;
+
+        uint32_t src, dest;
+        std::memcpy(&src, &fragment[12], 4);
+        std::memcpy(&dest, &fragment[16], 4);
+        Key key(src, dest, static_cast<uint16_t>((fragment[4] << 8) | fragment[5]), fragment[9]);
+
+        if (datagrams.size() >= max_datagrams && datagrams.count(key) == 0) {
+            return false;
+        }
+        auto found = datagrams.find(key);
+        if (found != datagrams.end() && !fits(*found->second, offset, end, more_fragments, header_length)) {
+            return false;
+        }
+        if (found == datagrams.end() && (offset == 0 ? header_length : 20) + end > MAX_DATAGRAM_SIZE) {
+            return false;
+        }
+        auto& datagram = datagrams[key];
+        if (!datagram) {
+            datagram.reset(new Datagram());
+            datagram->timer.set_callback([this, key] {
+                Key expired = key;
+                datagrams.erase(expired);
+            });
+            timer_wheel.schedule(datagram->timer, reassembly_timeout);
+        }
+
+        std::vector<uint8_t>& stored = datagram->fragments[offset];
+        datagram->bytes_held += payload_length - static_cast<uint32_t>(stored.size());
+        stored.assign(fragment.begin() + header_length, fragment.begin() + total_length);
+        datagram->max_end = std::max(datagram->max_end, end);
+        if (offset == 0) {
+            datagram->header.assign(fragment.begin(), fragment.begin() + header_length);
+        }
+        if (!more_fragments) {
+            datagram->data_length = end;
+        }
+
+        if (!is_complete(*datagram)) {
+            return false;
+        }
+
+        packet = datagram->header;
+        packet.resize(datagram->header.size() + datagram->data_length);
+        for (const auto& part : datagram->fragments) {
+            size_t length = part.first < datagram->data_length ? std::min<size_t>(part.second.size(), datagram->data_length - part.first) : 0;
+            std::memcpy(packet.data() + datagram->header.size() + part.first, part.second.data(), length);
+        }
+
+        uint16_t length = static_cast<uint16_t>(packet.size());
+        packet[2] = length >> 8;
+        packet[3] = length & 0xFF;
+        packet[6] &= 0x40; // keep DF, clear MF and the offset
+        packet[7] = 0x00;
+        packet[10] = 0x00;
+        packet[11] = 0x00;
+        uint16_t checksum = header_checksum(packet.data(), datagram->header.size());
+        packet[10] = checksum >> 8;
+        packet[11] = checksum & 0xFF;
+
+        datagrams.erase(key);
+        return true;
+    }
+
+    size_t pending() const {
+        return datagrams.size();
+    }
+
+private:
+    typedef std::tuple<uint32_t, uint32_t, uint16_t, uint8_t> Key; // src, dest, id, protocol
+
+    struct Datagram {
+        Datagram() : data_length(0), max_end(0), bytes_held(0) {}
+        std::vector<uint8_t> header;
+        std::map<uint32_t, std::vector<uint8_t>> fragments; // keyed by byte offset
+        uint32_t data_length; // known once the last fragment arrived
+        uint32_t max_end;     // furthest byte any fragment reaches
+        uint32_t bytes_held;  // payload stored, overlaps counted twice
+        TimerWheel::Timer timer;
+    };
+
+    TimerWheel& timer_wheel;
+    std::chrono::seconds reassembly_timeout;
+    size_t max_datagrams;
+    std::map<Key, std::unique_ptr<Datagram>> datagrams;
+
+    // Checks a fragment [offset, end) against what the datagram already
+    // established: it must stay within the last fragment's end, a second
+    // last fragment must agree on it, the reassembled size must fit an IPv4
+    // datagram, and overlapping copies may not hold more than that size.
+    bool fits(const Datagram& datagram, uint32_t offset, uint32_t end, bool more_fragments, size_t header_length) const {
+        if (datagram.data_length != 0 && (end > datagram.data_length || (!more_fragments && end != datagram.data_length))) {
+            return false;
+        }
+        if (!more_fragments && datagram.max_end > end) {
+            return false;
+        }
+        size_t header_size = offset == 0 ? header_length : (datagram.header.empty() ? 20 : datagram.header.size());
+        if (header_size + std::max(end, datagram.max_end) > MAX_DATAGRAM_SIZE) {
+            return false;
+        }
+        auto stored = datagram.fragments.find(offset);
+        uint32_t replaced = stored != datagram.fragments.end() ? static_cast<uint32_t>(stored->second.size()) : 0;
+        return datagram.bytes_held - replaced + (end - offset) <= MAX_DATAGRAM_SIZE;
+    }
+
+    static bool is_complete(const Datagram& datagram) {
+        if (datagram.header.empty() || datagram.data_length == 0) {
+            return false;
+        }
+        uint32_t covered = 0;
+        for (const auto& part : datagram.fragments) {
+            if (part.first > covered) {
+                return false; // hole
+            }
+            covered = std::max<uint32_t>(covered, part.first + static_cast<uint32_t>(part.second.size()));
+        }
+        return covered >= datagram.data_length;
+    }
+
+    static uint16_t header_checksum(const uint8_t* header, size_t length) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i + 1 < length; i += 2) {
+            sum += (header[i] << 8) | header[i + 1];
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        return static_cast<uint16_t>(~sum);
+    }
+};
 
 #endif // IP_H
@@ -19,6 +19,7 @@ public:
     }
 
     IPAddress(const std::string& addr) {
+        std::memset(address, 0, sizeof(address));
         if (addr.find(':') != std::string::npos) {
             type = IPv6;
             inet_pton(AF_INET6, addr.c_str(), address);
@@ -53,6 +54,10 @@ public:
         return address;
     }
 
+    bool operator==(const IPAddress& other) const {
+        return type == other.type && std::memcmp(address, other.address, sizeof(address)) == 0;
+    }
+
 private:
     Type type;
     uint8_t address[16]; // 128-bit for IPv6, only first 32-bit used for IPv4
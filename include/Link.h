@@ -0,0 +1,371 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <thread>
+#include "SPSCRing.h"
+#include "MPSCRing.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netpacket/packet.h>
+#include <poll.h>
+#endif
+
+// Link layer device: moves whole Ethernet frames to and from the wire.
+class Link {
+public:
+    virtual ~Link() {}
+
+    virtual bool transmit(const std::vector<uint8_t>& frame) = 0;
+
+    // Receives up to `max_frames` frames without blocking; returns the count appended.
+    virtual size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) = 0;
+
+    // Sends frames in order; returns how many were accepted.
+    virtual size_t transmit_burst(const std::vector<std::vector<uint8_t>>& frames) {
+        size_t sent = 0;
+        for (const auto& frame : frames) {
+            if (!transmit(frame)) {
+                break;
+            }
+            sent++;
+        }
+        return sent;
+    }
+
+    // True when the link holds frames until their departure time (see PacingQueue).
+    virtual bool supports_pacing() const {
+        return false;
+    }
+
+    // Sends the frame no earlier than `departure`. Links without a pacing
+    // queue send it at once.
+    virtual bool transmit_at(const std::vector<uint8_t>& frame, std::chrono::steady_clock::time_point) {
+        return transmit(frame);
+    }
+
+    // Blocks until a frame may be ready to receive or `timeout` passes. Links
+    // with nothing to wait on just sleep.
+    virtual void wait_for_frames(std::chrono::microseconds timeout) {
+        std::this_thread::sleep_for(timeout);
+    }
+};
+
+// In-memory link; two instances joined with connect() form a point-to-point
+// wire, which lets two stacks talk inside one process.
+class LoopbackLink : public Link {
+public:
+    LoopbackLink() : peer(this) {}
+
+    static void connect(LoopbackLink& a, LoopbackLink& b) {
+        a.peer = &b;
+        b.peer = &a;
+    }
+
+    bool transmit(const std::vector<uint8_t>& frame) override {
+        peer->rx_queue.push_back(frame);
+        return true;
+    }
+
+    size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) override {
+        size_t count = 0;
+        while (count < max_frames && !rx_queue.empty()) {
+            frames.push_back(std::move(rx_queue.front()));
+            rx_queue.pop_front();
+            count++;
+        }
+        return count;
+    }
+
+    void wait_for_frames(std::chrono::microseconds timeout) override {
+        if (rx_queue.empty()) {
+            std::this_thread::sleep_for(timeout);
+        }
+    }
+
+    size_t pending() const {
+        return rx_queue.size();
+    }
+
+private:
+    LoopbackLink* peer;
+    std::deque<std::vector<uint8_t>> rx_queue;
+};
+
+// Operating system raw socket. On Linux this is an AF_PACKET socket bound to
+// the interface; Windows cannot send Ethernet frames, so the IP packet inside
+// each frame is handed to a raw IP socket and nothing is received.
+class RawSocketLink : public Link {
+public:
+    explicit RawSocketLink(const std::string& interface_name = "eth0") : frames_dropped(0) {
+#ifdef _WIN32
+        sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+        if (sockfd == INVALID_SOCKET) {
+            std::cerr << "Failed to create socket." << std::endl;
+        }
+#else
+        ifindex = if_nametoindex(interface_name.c_str());
+        sockfd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+        if (sockfd < 0) {
+            std::cerr << "Failed to create socket." << std::endl;
+            return;
+        }
+        struct sockaddr_ll addr = {};
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = ifindex;
+        bind(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+#endif
+    }
+
+    ~RawSocketLink() {
+#ifdef _WIN32
+        if (sockfd != INVALID_SOCKET) {
+            closesocket(sockfd);
+        }
+#else
+        if (sockfd >= 0) {
+            close(sockfd);
+        }
+#endif
+    }
+
+    RawSocketLink(const RawSocketLink&) = delete;
+    RawSocketLink& operator=(const RawSocketLink&) = delete;
+
+    bool transmit(const std::vector<uint8_t>& frame) override {
+        if (frame.size() < 14) {
+            return false;
+        }
+#ifdef _WIN32
+        if (frame.size() < 34) {
+            return false;
+        }
+        sockaddr_in dest_addr;
+        std::memset(&dest_addr, 0, sizeof(dest_addr));
+        dest_addr.sin_family = AF_INET;
+        std::memcpy(&dest_addr.sin_addr.s_addr, frame.data() + 30, 4); // IPv4 destination
+
+        if (sendto(sockfd, reinterpret_cast<const char*>(frame.data() + 14), static_cast<int>(frame.size() - 14), 0, (sockaddr*)&dest_addr, sizeof(dest_addr)) == SOCKET_ERROR) {
+            frames_dropped++;
+            if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                std::cerr << "Failed to send frame." << std::endl;
+            }
+            return false;
+        }
+#else
+        struct sockaddr_ll dest_addr = {};
+        dest_addr.sll_ifindex = ifindex;
+        dest_addr.sll_protocol = htons((frame[12] << 8) | frame[13]);
+        dest_addr.sll_halen = ETH_ALEN;
+        std::memcpy(dest_addr.sll_addr, frame.data(), 6);
+
+        if (sendto(sockfd, frame.data(), frame.size(), 0, (struct sockaddr*)&dest_addr, sizeof(dest_addr)) < 0) {
+            frames_dropped++;
+            // A full device queue is routine on a non-blocking socket; only
+            // real errors are worth a line each
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to send frame." << std::endl;
+            }
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) override {
+        size_t count = 0;
+#ifndef _WIN32
+        uint8_t buffer[65536];
+        while (count < max_frames) {
+            ssize_t length = recv(sockfd, buffer, sizeof(buffer), 0);
+            if (length <= 0) {
+                break;
+            }
+            frames.emplace_back(buffer, buffer + length);
+            count++;
+        }
+#endif
+        return count;
+    }
+
+    // Frames the socket refused, including those dropped on a full queue
+    uint64_t get_frames_dropped() const {
+        return frames_dropped;
+    }
+
+#ifndef _WIN32
+    void wait_for_frames(std::chrono::microseconds timeout) override {
+        struct pollfd descriptor = { sockfd, POLLIN, 0 };
+        poll(&descriptor, 1, static_cast<int>((timeout.count() + 999) / 1000));
+    }
+#endif
+
+private:
+#ifdef _WIN32
+    SOCKET sockfd;
+#else
+    int sockfd;
+    unsigned int ifindex;
+#endif
+    uint64_t frames_dropped;
+};
+
+// Collects the frames the layers send during one round of a stack and hands
+// them to the device as a single transmit_burst() on flush(), or once
+// `max_batch` frames are queued. Frame buffers are reused from round to
+// round, so steady-state sending does not allocate. Paced frames go straight
+// to the device, whose queue already releases them in bursts.
+class TransmitBatcher : public Link {
+public:
+    explicit TransmitBatcher(Link& device, size_t max_batch = 256)
+        : device(device),
+        max_batch(max_batch),
+        bursts(0),
+        frames_sent(0),
+        frames_dropped(0) {}
+
+    TransmitBatcher(const TransmitBatcher&) = delete;
+    TransmitBatcher& operator=(const TransmitBatcher&) = delete;
+
+    bool transmit(const std::vector<uint8_t>& frame) override {
+        if (spare.empty()) {
+            batch.emplace_back(frame);
+        }
+        else {
+            batch.push_back(std::move(spare.back()));
+            spare.pop_back();
+            batch.back().assign(frame.begin(), frame.end());
+        }
+        if (batch.size() >= max_batch) {
+            flush();
+        }
+        return true;
+    }
+
+    size_t transmit_burst(const std::vector<std::vector<uint8_t>>& frames) override {
+        for (const auto& frame : frames) {
+            transmit(frame);
+        }
+        return frames.size();
+    }
+
+    size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) override {
+        return device.receive_burst(frames, max_frames);
+    }
+
+    bool supports_pacing() const override {
+        return device.supports_pacing();
+    }
+
+    bool transmit_at(const std::vector<uint8_t>& frame, std::chrono::steady_clock::time_point departure) override {
+        return device.transmit_at(frame, departure);
+    }
+
+    void wait_for_frames(std::chrono::microseconds timeout) override {
+        device.wait_for_frames(timeout);
+    }
+
+    // Sends the queued frames; returns how many the device accepted.
+    size_t flush() {
+        if (batch.empty()) {
+            return 0;
+        }
+        size_t sent = device.transmit_burst(batch);
+        bursts++;
+        frames_sent += sent;
+        frames_dropped += batch.size() - sent;
+        for (auto& frame : batch) {
+            frame.clear();
+            spare.push_back(std::move(frame));
+        }
+        batch.clear();
+        return sent;
+    }
+
+    size_t pending() const {
+        return batch.size();
+    }
+
+    uint64_t get_bursts() const {
+        return bursts;
+    }
+
+    uint64_t get_frames_sent() const {
+        return frames_sent;
+    }
+
+    // Frames the device refused
+    uint64_t get_frames_dropped() const {
+        return frames_dropped;
+    }
+
+private:
+    Link& device;
+    size_t max_batch;
+    std::vector<std::vector<uint8_t>> batch;
+    std::vector<std::vector<uint8_t>> spare; // cleared buffers of earlier batches
+    uint64_t bursts;
+    uint64_t frames_sent;
+    uint64_t frames_dropped;
+};
+
+// One queue of a software multi-queue device, for a stack running on
+// another thread than the one that drives the real device (a ShardedStack
+// shard behind a software dispatcher). Received frames arrive through an
+// SPSC ring the dispatcher fills; sent frames go to an MPSC ring shared by
+// all queues, which the dispatcher drains onto the device. Frames cross
+// the rings as vectors, so only their handles are copied on the way in.
+class RingLink : public Link {
+public:
+    RingLink(SPSCRing<std::vector<uint8_t>>& rx, MPSCRing<std::vector<uint8_t>>& tx) : rx(rx), tx(tx) {}
+
+    RingLink(const RingLink&) = delete;
+    RingLink& operator=(const RingLink&) = delete;
+
+    // False when the transmit ring is full.
+    bool transmit(const std::vector<uint8_t>& frame) override {
+        return tx.push(frame);
+    }
+
+    size_t transmit_burst(const std::vector<std::vector<uint8_t>>& frames) override {
+        return tx.enqueue_burst(frames.data(), frames.size());
+    }
+
+    size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) override {
+        size_t first = frames.size();
+        frames.resize(first + max_frames);
+        size_t count = rx.dequeue_burst(&frames[first], max_frames);
+        frames.resize(first + count);
+        return count;
+    }
+
+    void wait_for_frames(std::chrono::microseconds timeout) override {
+        if (rx.empty()) {
+            std::this_thread::sleep_for(timeout);
+        }
+    }
+
+private:
+    SPSCRing<std::vector<uint8_t>>& rx;
+    MPSCRing<std::vector<uint8_t>>& tx;
+};
+
+#endif // LINK_H
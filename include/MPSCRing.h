@@ -0,0 +1,151 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi-producer, single-consumer ring: several threads
+// (shards, application threads) hand entries to one owner. A producer
+// reserves a run of slots with one compare-and-swap on the tail, fills
+// them, and marks each slot ready with its own sequence number (Vyukov's
+// bounded queue). Producers never wait for one another: a producer that
+// is preempted between reserving and publishing only holds back the
+// consumer, which stops at the first slot that is not ready yet. The
+// consumer frees a whole burst with one release store of the head.
+//
+// The producers share the tail line; the consumer's head is on a line of
+// its own and is read by producers only when the ring looks full.
+template <typename T>
+class MPSCRing {
+public:
+    // The capacity is rounded up to a power of two.
+    explicit MPSCRing(size_t capacity = 1024)
+        : mask(static_cast<uint32_t>(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)),
+        slots(new Slot[mask + 1]) {
+        producers.tail.store(0, std::memory_order_relaxed);
+        producers.cached_head.store(0, std::memory_order_relaxed);
+        consumer.head.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i <= mask; i++) {
+            slots[i].sequence.store(i - 1, std::memory_order_relaxed); // not ready for position i
+        }
+    }
+
+    MPSCRing(const MPSCRing&) = delete;
+    MPSCRing& operator=(const MPSCRing&) = delete;
+
+    // Any thread. False when the ring is full.
+    bool push(T entry) {
+        uint32_t position;
+        if (reserve(1, position) == 0) {
+            return false;
+        }
+        Slot& slot = slots[position & mask];
+        slot.value = std::move(entry);
+        slot.sequence.store(position, std::memory_order_release);
+        return true;
+    }
+
+    // Any thread. Enqueues as many of `entries` as fit, in order and
+    // contiguously; returns the count.
+    size_t enqueue_burst(const T* entries, size_t count) {
+        uint32_t position;
+        count = reserve(count, position);
+        for (size_t i = 0; i < count; i++) {
+            Slot& slot = slots[(position + i) & mask];
+            slot.value = entries[i];
+            slot.sequence.store(position + static_cast<uint32_t>(i), std::memory_order_release);
+        }
+        return count;
+    }
+
+    // Consumer only. False when no entry is ready.
+    bool pop(T& entry) {
+        return dequeue_burst(&entry, 1) == 1;
+    }
+
+    // Consumer only. Dequeues up to `max_count` ready entries; returns the count.
+    size_t dequeue_burst(T* entries, size_t max_count) {
+        uint32_t head = consumer.head.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < max_count) {
+            Slot& slot = slots[(head + count) & mask];
+            if (slot.sequence.load(std::memory_order_acquire) != head + static_cast<uint32_t>(count)) {
+                break;
+            }
+            entries[count] = std::move(slot.value);
+            count++;
+        }
+        if (count > 0) {
+            consumer.head.store(head + static_cast<uint32_t>(count), std::memory_order_release);
+        }
+        return count;
+    }
+
+    // Entries reserved and not yet consumed; approximate while producers run.
+    size_t size() const {
+        return producers.tail.load(std::memory_order_acquire) - consumer.head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence; // equals the position once the entry is ready
+        T value;
+    };
+
+    struct alignas(64) Producers {
+        std::atomic<uint32_t> tail; // next slot to reserve
+        std::atomic<uint32_t> cached_head; // a recent head, saves reading the consumer's line
+    };
+
+    struct alignas(64) Consumer {
+        std::atomic<uint32_t> head; // next slot to consume
+    };
+
+    Producers producers;
+    Consumer consumer;
+    const uint32_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    // Reserves up to `count` slots starting at `position`; returns how many.
+    size_t reserve(size_t count, uint32_t& position) {
+        uint32_t tail = producers.tail.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t head = producers.cached_head.load(std::memory_order_acquire);
+            uint32_t used = tail - head;
+            size_t free_slots = used > mask ? 0 : mask + 1 - used;
+            if (free_slots < count) {
+                head = consumer.head.load(std::memory_order_acquire);
+                producers.cached_head.store(head, std::memory_order_release);
+                used = tail - head;
+                if (static_cast<int32_t>(used) < 0) {
+                    tail = producers.tail.load(std::memory_order_relaxed); // our tail is older than the head
+                    continue;
+                }
+                free_slots = mask + 1 - used;
+            }
+            size_t reserved = std::min(count, free_slots);
+            if (reserved == 0) {
+                return 0;
+            }
+            if (producers.tail.compare_exchange_weak(tail, tail + static_cast<uint32_t>(reserved), std::memory_order_relaxed)) {
+                position = tail;
+                return reserved;
+            }
+        }
+    }
+};
+
+#endif // MPSCRING_H
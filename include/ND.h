@@ -7,6 +7,7 @@
 #include <vector>
 #include <cstring>
 #include <iostream>
+#include "NeighborCache.h"
 
 class ND {
 public:
@@ -56,4 +57,11 @@ bool ND::parse_na_packet(const std::vector<uint8_t>& packet, uint32_t& src_ip, u
     return true;
 }
 
+// IPv6 neighbor cache using the RFC 4861 REACHABLE_TIME of 30 s
+class NDCache : public NeighborCache<uint32_t> {
+public:
+    explicit NDCache(TimerWheel& timers)
+        : NeighborCache<uint32_t>(timers, std::chrono::seconds(30)) {}
+};
+
 #endif // ND_H
@@ -0,0 +1,62 @@
+#ifndef NEIGHBORCACHE_H
+#define NEIGHBORCACHE_H
+
+#include "TimerWheel.h"
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+// Address -> MAC mapping shared by ARP (IPv4) and ND (IPv6). Each entry
+// carries its own expiry timer on the shared wheel, so stale entries are
+// dropped without scanning the table.
+template <typename Address>
+class NeighborCache {
+public:
+    NeighborCache(TimerWheel& timers, std::chrono::seconds reachable = std::chrono::seconds(60))
+        : timer_wheel(timers), reachable_time(reachable) {}
+
+    // Inserts or refreshes a mapping and restarts its expiry timer.
+    void update(const Address& address, const uint8_t* mac) {
+        auto& entry = entries[address];
+        if (!entry) {
+            entry.reset(new Entry());
+            entry->timer.set_callback([this, address] {
+                Address key = address;
+                entries.erase(key); // destroys this callback; nothing is touched afterwards
+            });
+        }
+        std::memcpy(entry->mac, mac, 6);
+        timer_wheel.schedule(entry->timer, reachable_time);
+    }
+
+    bool lookup(const Address& address, uint8_t* mac) const {
+        auto it = entries.find(address);
+        if (it == entries.end()) {
+            return false;
+        }
+        std::memcpy(mac, it->second->mac, 6);
+        return true;
+    }
+
+    void remove(const Address& address) {
+        entries.erase(address);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        uint8_t mac[6];
+        TimerWheel::Timer timer;
+    };
+
+    TimerWheel& timer_wheel;
+    std::chrono::seconds reachable_time;
+    std::unordered_map<Address, std::unique_ptr<Entry>> entries;
+};
+
+#endif // NEIGHBORCACHE_H
@@ -0,0 +1,208 @@
+#ifndef PACINGQUEUE_H
+#define PACINGQUEUE_H
+
+#include "Link.h"
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <bit>
+
+// Per-interface earliest-departure-time queue (the Linux fq/EDT model,
+// Carousel's timing wheel). Connections stamp each data frame with the time
+// it may leave, derived from their pacing rate; the queue holds frames in a
+// ring of time slots and poll() hands everything that is due to the device
+// in one burst, in departure order and FIFO within a slot. Unpaced frames
+// (plain transmit(): ACKs, control segments) go straight to the device.
+//
+// Departures earlier than the last poll leave on the next one; departures
+// beyond the horizon (slots * granularity) are clamped to its end.
+class PacingQueue : public Link {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PacingQueue(Link& device, std::chrono::nanoseconds granularity = std::chrono::microseconds(8), size_t slots = 16384, Clock::time_point start = Clock::now())
+        : device(device),
+        granularity(granularity),
+        start_time(start),
+        slot_mask(std::bit_ceil(slots) - 1),
+        head(slot_mask + 1, NONE),
+        tail(slot_mask + 1, NONE),
+        occupied((slot_mask + 1 + 63) / 64, 0),
+        free_entries(NONE),
+        cursor(0),
+        count(0),
+        frames_paced(0),
+        frames_dropped(0) {}
+
+    PacingQueue(const PacingQueue&) = delete;
+    PacingQueue& operator=(const PacingQueue&) = delete;
+
+    bool transmit(const std::vector<uint8_t>& frame) override {
+        return device.transmit(frame);
+    }
+
+    size_t receive_burst(std::vector<std::vector<uint8_t>>& frames, size_t max_frames) override {
+        return device.receive_burst(frames, max_frames);
+    }
+
+    bool supports_pacing() const override {
+        return true;
+    }
+
+    void wait_for_frames(std::chrono::microseconds timeout) override {
+        device.wait_for_frames(timeout);
+    }
+
+    bool transmit_at(const std::vector<uint8_t>& frame, Clock::time_point departure) override {
+        uint64_t slot = std::max(tick(departure), cursor);
+        if (slot - cursor > slot_mask) {
+            slot = cursor + slot_mask;
+        }
+
+        uint32_t index = allocate_entry();
+        entries[index].frame = frame;
+        entries[index].next = NONE;
+        size_t position = static_cast<size_t>(slot & slot_mask);
+        if (head[position] == NONE) {
+            head[position] = index;
+            occupied[position >> 6] |= uint64_t(1) << (position & 63);
+        }
+        else {
+            entries[tail[position]].next = index;
+        }
+        tail[position] = index;
+        count++;
+        return true;
+    }
+
+    // Sends every frame whose departure time is at or before `now`; returns the count.
+    size_t poll(Clock::time_point now) {
+        uint64_t target = tick(now);
+        while (count > 0 && cursor <= target) {
+            size_t position = static_cast<size_t>(cursor & slot_mask);
+            uint64_t word = occupied[position >> 6] >> (position & 63);
+            if (word == 0) {
+                // Nothing else in this bitmap word: skip to the next one
+                cursor = std::min<uint64_t>(cursor + 64 - (position & 63), target + 1);
+                continue;
+            }
+            if ((word & 1) == 0) {
+                cursor = std::min<uint64_t>(cursor + std::countr_zero(word), target + 1);
+                continue;
+            }
+            release_slot(position);
+            cursor++;
+        }
+        if (cursor <= target) {
+            cursor = target + 1; // idle: later departures are measured from now
+        }
+        return flush();
+    }
+
+    // Departure time of the earliest queued frame, or Clock::time_point::max() when empty.
+    Clock::time_point next_departure() const {
+        if (count == 0) {
+            return Clock::time_point::max();
+        }
+        for (uint64_t slot = cursor; slot <= cursor + slot_mask; slot++) {
+            size_t position = static_cast<size_t>(slot & slot_mask);
+            uint64_t word = occupied[position >> 6] >> (position & 63);
+            if (word & 1) {
+                return start_time + std::chrono::duration_cast<Clock::duration>(granularity * slot);
+            }
+            if (word == 0) {
+                slot += 63 - (position & 63);
+            }
+        }
+        return Clock::time_point::max();
+    }
+
+    size_t pending() const {
+        return count;
+    }
+
+    uint64_t get_frames_paced() const {
+        return frames_paced;
+    }
+
+    // Frames the device refused while draining a slot
+    uint64_t get_frames_dropped() const {
+        return frames_dropped;
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        std::vector<uint8_t> frame;
+        uint32_t next;
+    };
+
+    Link& device;
+    std::chrono::nanoseconds granularity;
+    Clock::time_point start_time;
+    uint64_t slot_mask;
+    std::vector<uint32_t> head; // per slot: first and last queued entry
+    std::vector<uint32_t> tail;
+    std::vector<uint64_t> occupied; // bit per non-empty slot
+    std::vector<Entry> entries;     // pool; frame buffers are reused
+    uint32_t free_entries;
+    uint64_t cursor; // next slot to release
+    size_t count;
+    std::vector<std::vector<uint8_t>> burst;
+    std::vector<uint32_t> burst_entries;
+    uint64_t frames_paced;
+    uint64_t frames_dropped;
+
+    uint64_t tick(Clock::time_point time) const {
+        if (time <= start_time) {
+            return 0;
+        }
+        return static_cast<uint64_t>((time - start_time) / granularity);
+    }
+
+    uint32_t allocate_entry() {
+        if (free_entries != NONE) {
+            uint32_t index = free_entries;
+            free_entries = entries[index].next;
+            return index;
+        }
+        entries.emplace_back();
+        return static_cast<uint32_t>(entries.size() - 1);
+    }
+
+    // Moves the slot's frames to the pending burst; their buffers return to
+    // the pool after the device has taken them.
+    void release_slot(size_t position) {
+        for (uint32_t index = head[position]; index != NONE; index = entries[index].next) {
+            burst.push_back(std::move(entries[index].frame));
+            burst_entries.push_back(index);
+            count--;
+        }
+        head[position] = NONE;
+        tail[position] = NONE;
+        occupied[position >> 6] &= ~(uint64_t(1) << (position & 63));
+    }
+
+    size_t flush() {
+        if (burst.empty()) {
+            return 0;
+        }
+        size_t sent = device.transmit_burst(burst);
+        frames_paced += sent;
+        frames_dropped += burst.size() - sent;
+        for (size_t i = 0; i < burst_entries.size(); i++) {
+            Entry& entry = entries[burst_entries[i]];
+            entry.frame = std::move(burst[i]);
+            entry.frame.clear();
+            entry.next = free_entries;
+            free_entries = burst_entries[i];
+        }
+        burst.clear();
+        burst_entries.clear();
+        return sent;
+    }
+};
+
+#endif // PACINGQUEUE_H
@@ -0,0 +1,98 @@
+#ifndef RTTESTIMATOR_H
+#define RTTESTIMATOR_H
+
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+// Smoothed RTT and retransmission timeout per RFC 6298. Samples must follow
+// Karn's algorithm: never time a retransmitted segment unless the timestamp
+// option identifies the transmission being acknowledged.
+class RTTEstimator {
+public:
+    // The RFC recommends a 1 s lower bound; 200 ms (as in Linux) suits
+    // low-latency links. Callers can raise it with set_min_rto().
+    explicit RTTEstimator(std::chrono::microseconds min = std::chrono::milliseconds(200),
+        std::chrono::microseconds max = std::chrono::seconds(60))
+        : srtt_us(0),
+        rttvar_us(0),
+        min_rtt_us(0),
+        rto_us(INITIAL_RTO_US),
+        min_rto_us(to_us(min)),
+        max_rto_us(to_us(max)),
+        backoff_count(0) {}
+
+    void add_sample(std::chrono::microseconds rtt) {
+        uint32_t sample = std::max<uint32_t>(to_us(rtt), 1);
+
+        if (srtt_us == 0) {
+            srtt_us = sample;
+            rttvar_us = sample / 2;
+        }
+        else {
+            uint32_t delta = srtt_us > sample ? srtt_us - sample : sample - srtt_us;
+            rttvar_us = static_cast<uint32_t>((static_cast<uint64_t>(rttvar_us) * 3 + delta) / 4);
+            srtt_us = static_cast<uint32_t>((static_cast<uint64_t>(srtt_us) * 7 + sample) / 8);
+        }
+
+        if (min_rtt_us == 0 || sample < min_rtt_us) {
+            min_rtt_us = sample;
+        }
+
+        uint64_t rto = static_cast<uint64_t>(srtt_us) + std::max<uint64_t>(GRANULARITY_US, static_cast<uint64_t>(rttvar_us) * 4);
+        rto_us = static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(rto, min_rto_us), max_rto_us));
+        backoff_count = 0;
+    }
+
+    // Exponential backoff after a retransmission timeout (RFC 6298 5.5).
+    void backoff() {
+        if (backoff_count < MAX_BACKOFF) {
+            backoff_count++;
+        }
+    }
+
+    std::chrono::microseconds rto() const {
+        return std::chrono::microseconds(std::min<uint64_t>(static_cast<uint64_t>(rto_us) << backoff_count, max_rto_us));
+    }
+
+    std::chrono::microseconds srtt() const {
+        return std::chrono::microseconds(srtt_us);
+    }
+
+    std::chrono::microseconds rttvar() const {
+        return std::chrono::microseconds(rttvar_us);
+    }
+
+    std::chrono::microseconds min_rtt() const {
+        return std::chrono::microseconds(min_rtt_us);
+    }
+
+    bool has_sample() const {
+        return srtt_us != 0;
+    }
+
+    void set_min_rto(std::chrono::microseconds min) {
+        min_rto_us = to_us(min);
+    }
+
+private:
+    static const uint32_t INITIAL_RTO_US = 1000000; // RFC 6298 2.1
+    static const uint32_t GRANULARITY_US = 1000;
+    static const uint32_t MAX_BACKOFF = 6;
+
+    // Kept as 32-bit microsecond counts (up to ~71 minutes) so the estimator
+    // adds 28 bytes to a connection rather than 56.
+    uint32_t srtt_us;
+    uint32_t rttvar_us;
+    uint32_t min_rtt_us;
+    uint32_t rto_us;
+    uint32_t min_rto_us;
+    uint32_t max_rto_us;
+    uint32_t backoff_count;
+
+    static uint32_t to_us(std::chrono::microseconds value) {
+        return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(value.count(), 0), UINT32_MAX));
+    }
+};
+
+#endif // RTTESTIMATOR_H
@@ -0,0 +1,263 @@
+#ifndef RECEIVEOFFLOAD_H
+#define RECEIVEOFFLOAD_H
+
+#include "TCP.h"
+#include "Checksum.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// A TCP segment handed from the receive offload to the TCP layer, with the
+// fields of the IP header that carried it. Addresses are as IPPacket::src
+// and IPPacket::dest of the deserialized packet.
+struct ReceivedSegment {
+    uint32_t src_ip;
+    uint32_t dest_ip;
+    uint8_t dscp_ecn;
+    uint16_t segment_count; // wire segments merged into this one
+    TCPSegment segment;
+};
+
+// Software generic receive offload. Sits between a link RX burst and the
+// TCP layer: IPv4/TCP headers are parsed in place, checksums verified, and
+// consecutive in-order data segments of a flow are merged into one large
+// segment, so the TCP input path and the ACK logic run once per run of
+// segments instead of once per MSS. A flow is flushed on PSH, a sequence
+// gap, a change in ACK, options or TOS, a short segment, the size limit or
+// the end of the burst. Segments carrying SYN, FIN, RST, URG, ECE or CWR,
+// and pure ACKs, pass through unmerged.
+class ReceiveOffload {
+public:
+    explicit ReceiveOffload(size_t max_flows = 8, size_t max_size = 65535)
+        : max_flows(max_flows),
+        max_size(max_size),
+        frames_received(0),
+        segments_delivered(0),
+        checksum_errors(0) {}
+
+    // Consumes one RX burst. TCP segments are appended to `segments`; frames
+    // that are not IPv4/TCP are moved to `others` untouched.
+    void receive_burst(std::vector<std::vector<uint8_t>>& frames, std::vector<ReceivedSegment>& segments, std::vector<std::vector<uint8_t>>& others) {
+        for (auto& frame : frames) {
+            frames_received++;
+            Header header;
+            if (!parse(frame, header)) {
+                others.push_back(std::move(frame));
+                continue;
+            }
+            if (!checksums_valid(frame, header)) {
+                checksum_errors++;
+                continue;
+            }
+            receive_segment(frame, header, segments);
+        }
+        flush_all(segments);
+    }
+
+    uint64_t get_frames_received() const {
+        return frames_received;
+    }
+
+    uint64_t get_segments_delivered() const {
+        return segments_delivered;
+    }
+
+    uint64_t get_checksum_errors() const {
+        return checksum_errors;
+    }
+
+private:
+    static const size_t ETHERNET_HEADER_LENGTH = 14;
+    static const uint8_t MERGEABLE_FLAGS = TCPSegment::ACK | TCPSegment::PSH;
+
+    struct Header {
+        size_t ip_offset;
+        size_t tcp_offset;
+        size_t tcp_length;     // TCP header plus payload, Ethernet padding excluded
+        size_t payload_offset;
+        size_t payload_length;
+        uint32_t src_ip;
+        uint32_t dest_ip;
+        uint16_t src_port;
+        uint16_t dest_port;
+        uint32_t seq;
+        uint32_t ack;
+        uint8_t flags;
+        uint8_t dscp_ecn;
+    };
+
+    struct Flow {
+        uint32_t src_ip;
+        uint32_t dest_ip;
+        uint16_t src_port;
+        uint16_t dest_port;
+        uint8_t dscp_ecn;
+        uint32_t next_seq;
+        uint32_t ack;
+        uint8_t flags;
+        uint16_t window;
+        size_t segment_size; // payload of the first segment; later ones may not exceed it
+        uint16_t segment_count;
+        std::vector<uint8_t> header; // TCP header of the first segment, options included
+        std::vector<uint8_t> payload;
+    };
+
+    size_t max_flows;
+    size_t max_size;
+    std::vector<Flow> flows; // flows with a merge in progress, oldest first
+    uint64_t frames_received;
+    uint64_t segments_delivered;
+    uint64_t checksum_errors;
+
+    static uint16_t get16(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    static bool parse(const std::vector<uint8_t>& frame, Header& header) {
+        const size_t ip = ETHERNET_HEADER_LENGTH;
+        if (frame.size() < ip + 40 || get16(&frame[12]) != 0x0800 || (frame[ip] >> 4) != 4) {
+            return false;
+        }
+        size_t ip_header_length = (frame[ip] & 0x0F) * 4;
+        size_t total_length = get16(&frame[ip + 2]);
+        if (ip_header_length < 20 || total_length < ip_header_length + 20 || ip + total_length > frame.size()
+            || frame[ip + 9] != IPPROTO_TCP || (get16(&frame[ip + 6]) & 0x3FFF) != 0) {
+            return false; // not TCP, truncated, or a fragment
+        }
+
+        const size_t tcp = ip + ip_header_length;
+        size_t tcp_header_length = (frame[tcp + 12] >> 4) * 4;
+        if (tcp_header_length < 20 || tcp_header_length > total_length - ip_header_length) {
+            return false;
+        }
+
+        header.ip_offset = ip;
+        header.tcp_offset = tcp;
+        header.tcp_length = total_length - ip_header_length;
+        header.payload_offset = tcp + tcp_header_length;
+        header.payload_length = header.tcp_length - tcp_header_length;
+        header.src_ip = get32(&frame[ip + 12]);
+        header.dest_ip = get32(&frame[ip + 16]);
+        header.src_port = get16(&frame[tcp]);
+        header.dest_port = get16(&frame[tcp + 2]);
+        header.seq = get32(&frame[tcp + 4]);
+        header.ack = get32(&frame[tcp + 8]);
+        header.flags = frame[tcp + 13];
+        header.dscp_ecn = frame[ip + 1];
+        return true;
+    }
+
+    static bool checksums_valid(const std::vector<uint8_t>& frame, const Header& header) {
+        size_t ip_header_length = header.tcp_offset - header.ip_offset;
+        if (Checksum::fold(Checksum::add(&frame[header.ip_offset], ip_header_length)) != 0) {
+            return false;
+        }
+        uint32_t sum = Checksum::pseudo_header(&frame[header.ip_offset + 12], &frame[header.ip_offset + 16], IPPROTO_TCP, static_cast<uint16_t>(header.tcp_length));
+        return Checksum::fold(Checksum::add(&frame[header.tcp_offset], header.tcp_length, sum)) == 0;
+    }
+
+    static bool same_flow(const Flow& flow, const Header& header) {
+        return flow.src_ip == header.src_ip && flow.dest_ip == header.dest_ip
+            && flow.src_port == header.src_port && flow.dest_port == header.dest_port;
+    }
+
+    static bool mergeable(const Header& header) {
+        return header.payload_length > 0 && (header.flags & TCPSegment::ACK) && (header.flags & ~MERGEABLE_FLAGS) == 0;
+    }
+
+    // Options (timestamps, SACK blocks) must match byte for byte; the window may differ.
+    static bool same_options(const Flow& flow, const std::vector<uint8_t>& frame, const Header& header) {
+        size_t length = header.payload_offset - header.tcp_offset;
+        return length == flow.header.size() && memcmp(flow.header.data() + 20, &frame[header.tcp_offset + 20], length - 20) == 0;
+    }
+
+    void receive_segment(const std::vector<uint8_t>& frame, const Header& header, std::vector<ReceivedSegment>& segments) {
+        size_t index = 0;
+        while (index < flows.size() && !same_flow(flows[index], header)) {
+            index++;
+        }
+
+        if (index < flows.size()) {
+            Flow& flow = flows[index];
+            if (mergeable(header) && header.seq == flow.next_seq && header.ack == flow.ack
+                && header.dscp_ecn == flow.dscp_ecn && header.payload_length <= flow.segment_size
+                && flow.payload.size() + header.payload_length <= max_size && same_options(flow, frame, header)) {
+                const uint8_t* payload = &frame[header.payload_offset];
+                flow.payload.insert(flow.payload.end(), payload, payload + header.payload_length);
+                flow.next_seq += static_cast<uint32_t>(header.payload_length);
+                flow.flags |= header.flags;
+                flow.window = get16(&frame[header.tcp_offset + 14]);
+                flow.segment_count++;
+                if ((header.flags & TCPSegment::PSH) || header.payload_length < flow.segment_size) {
+                    flush(index, segments);
+                }
+                return;
+            }
+            flush(index, segments);
+        }
+
+        if (!mergeable(header) || (header.flags & TCPSegment::PSH)) {
+            deliver_single(frame, header, segments);
+            return;
+        }
+
+        if (flows.size() >= max_flows) {
+            flush(0, segments);
+        }
+        flows.emplace_back();
+        Flow& flow = flows.back();
+        flow.src_ip = header.src_ip;
+        flow.dest_ip = header.dest_ip;
+        flow.src_port = header.src_port;
+        flow.dest_port = header.dest_port;
+        flow.dscp_ecn = header.dscp_ecn;
+        flow.next_seq = header.seq + static_cast<uint32_t>(header.payload_length);
+        flow.ack = header.ack;
+        flow.flags = header.flags;
+        flow.window = get16(&frame[header.tcp_offset + 14]);
+        flow.segment_size = header.payload_length;
+        flow.segment_count = 1;
+        flow.header.assign(frame.begin() + header.tcp_offset, frame.begin() + header.payload_offset);
+        flow.payload.reserve(max_size);
+        flow.payload.assign(frame.begin() + header.payload_offset, frame.begin() + header.payload_offset + header.payload_length);
+    }
+
+    // Builds the TCPSegment the rest of the stack expects from the first
+    // segment's header and the merged payload.
+    static ReceivedSegment make_segment(uint32_t src_ip, uint32_t dest_ip, uint8_t dscp_ecn, const uint8_t* tcp_header, size_t tcp_header_length,
+        uint32_t ack, uint8_t flags, uint16_t window, uint16_t count, std::vector<uint8_t>&& payload) {
+        ReceivedSegment received{ src_ip, dest_ip, dscp_ecn, count,
+            TCPSegment(get16(tcp_header), get16(tcp_header + 2), get32(tcp_header + 4), ack, {}, flags) };
+        received.segment.window_size = htons(window);
+        received.segment.options = TCPOptions::parse(tcp_header + 20, tcp_header_length - 20);
+        received.segment.payload = std::move(payload);
+        return received;
+    }
+
+    void deliver_single(const std::vector<uint8_t>& frame, const Header& header, std::vector<ReceivedSegment>& segments) {
+        std::vector<uint8_t> payload(frame.begin() + header.payload_offset, frame.begin() + header.payload_offset + header.payload_length);
+        segments.push_back(make_segment(header.src_ip, header.dest_ip, header.dscp_ecn, &frame[header.tcp_offset], header.payload_offset - header.tcp_offset,
+            header.ack, header.flags, get16(&frame[header.tcp_offset + 14]), 1, std::move(payload)));
+        segments_delivered++;
+    }
+
+    void flush(size_t index, std::vector<ReceivedSegment>& segments) {
+        Flow& flow = flows[index];
+        segments.push_back(make_segment(flow.src_ip, flow.dest_ip, flow.dscp_ecn, flow.header.data(), flow.header.size(),
+            flow.ack, flow.flags, flow.window, flow.segment_count, std::move(flow.payload)));
+        segments_delivered++;
+        flows.erase(flows.begin() + index);
+    }
+
+    void flush_all(std::vector<ReceivedSegment>& segments) {
+        while (!flows.empty()) {
+            flush(0, segments);
+        }
+    }
+};
+
+#endif // RECEIVEOFFLOAD_H
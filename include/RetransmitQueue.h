@@ -0,0 +1,290 @@
+#ifndef RETRANSMITQUEUE_H
+#define RETRANSMITQUEUE_H
+
+#include "TCP.h"
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <memory>
+
+// One transmission of [seq, end_seq). The payload is not copied: it is
+// still in the connection's send buffer at offset seq - snd_una, and
+// headers are rebuilt on retransmission.
+struct SentSegment {
+    uint32_t seq;
+    uint32_t end_seq;
+    uint8_t flags;
+    bool retransmitted;
+    bool lost;
+    bool sacked;
+    std::chrono::steady_clock::time_point xmit_time;
+};
+
+// Unacknowledged segments in sequence order. New data is always sent at
+// snd_nxt, so records are appended at the back and a cumulative ACK pops
+// them from the front in O(1) each; SACK blocks are located by binary
+// search. Storage is a ring of 32-byte records that is allocated on the
+// first send and freed when everything is acknowledged.
+//
+// The segments still in flight (neither SACKed nor marked lost) are also
+// linked in transmission order, so RACK can stop at the first segment that
+// is not yet lost (RFC 8985 6.2), and the pipe and lost counts are kept
+// as the flags change. Change lost, sacked and xmit_time through
+// mark_lost(), mark_sacked() and mark_resent() to keep them consistent.
+class RetransmitQueue {
+public:
+    RetransmitQueue()
+        : capacity(0),
+        head(0),
+        count(0),
+        oldest(NONE),
+        newest(NONE),
+        in_flight_bytes(0),
+        lost_segments(0),
+        lost_hint(0) {}
+
+    RetransmitQueue(const RetransmitQueue&) = delete;
+    RetransmitQueue& operator=(const RetransmitQueue&) = delete;
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    SentSegment& operator[](size_t index) {
+        return storage[slot_of(index)].segment;
+    }
+
+    const SentSegment& operator[](size_t index) const {
+        return storage[slot_of(index)].segment;
+    }
+
+    SentSegment& front() {
+        return (*this)[0];
+    }
+
+    SentSegment& back() {
+        return (*this)[count - 1];
+    }
+
+    // New segments are in flight and the most recently sent
+    void push_back(const SentSegment& segment) {
+        reserve(count + 1);
+        uint32_t slot = slot_of(count);
+        storage[slot].segment = segment;
+        storage[slot].segment.lost = false;
+        storage[slot].segment.sacked = false;
+        count++;
+        link_newest(slot);
+    }
+
+    void pop_front() {
+        const SentSegment& segment = storage[head].segment;
+        if (segment.lost) {
+            lost_segments--;
+        }
+        else if (!segment.sacked) {
+            unlink(head);
+        }
+        head = (head + 1) & (capacity - 1);
+        if (--count == 0) {
+            clear();
+        }
+    }
+
+    void clear() {
+        storage.reset();
+        head = 0;
+        count = 0;
+        oldest = NONE;
+        newest = NONE;
+        in_flight_bytes = 0;
+        lost_segments = 0;
+    }
+
+    // Index of the first segment starting at or after `seq`
+    size_t lower_bound(uint32_t seq) const {
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (seq_before((*this)[middle].seq, seq)) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Segments in flight in transmission order; size() ends the walk
+    size_t oldest_in_flight() const {
+        return index_of(oldest);
+    }
+
+    size_t next_in_flight(size_t index) const {
+        return index_of(storage[slot_of(index)].next);
+    }
+
+    void mark_lost(size_t index) {
+        uint32_t slot = slot_of(index);
+        SentSegment& segment = storage[slot].segment;
+        if (segment.lost || segment.sacked) {
+            return;
+        }
+        unlink(slot);
+        segment.lost = true;
+        if (lost_segments++ == 0 || seq_before(segment.seq, lost_hint)) {
+            lost_hint = segment.seq;
+        }
+    }
+
+    void mark_sacked(size_t index) {
+        uint32_t slot = slot_of(index);
+        SentSegment& segment = storage[slot].segment;
+        if (segment.sacked) {
+            return;
+        }
+        if (segment.lost) {
+            lost_segments--;
+        }
+        else {
+            unlink(slot);
+        }
+        segment.lost = false;
+        segment.sacked = true;
+    }
+
+    // A retransmission puts the segment back in flight as the newest one
+    void mark_resent(size_t index, std::chrono::steady_clock::time_point now) {
+        uint32_t slot = slot_of(index);
+        SentSegment& segment = storage[slot].segment;
+        if (segment.lost) {
+            lost_segments--;
+        }
+        else if (!segment.sacked) {
+            unlink(slot);
+        }
+        segment.xmit_time = now;
+        segment.retransmitted = true;
+        segment.lost = false;
+        if (!segment.sacked) {
+            link_newest(slot);
+        }
+    }
+
+    // Sequence space sent and neither SACKed nor marked lost (RFC 6675 pipe)
+    uint32_t pipe() const {
+        return in_flight_bytes;
+    }
+
+    size_t lost_count() const {
+        return lost_segments;
+    }
+
+    // Index of the lowest segment marked lost, or size() if none. The scan
+    // resumes where the previous one stopped, so walking the holes of one
+    // recovery costs O(n) in total rather than per call.
+    size_t first_lost() {
+        if (lost_segments == 0) {
+            return count;
+        }
+        size_t index = lower_bound(lost_hint);
+        while (!(*this)[index].lost) {
+            index++;
+        }
+        lost_hint = (*this)[index].seq;
+        return index;
+    }
+
+private:
+    static constexpr size_t MIN_CAPACITY = 16;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Links are ring slots, which stay put until the ring grows
+    struct Record {
+        SentSegment segment;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    std::unique_ptr<Record[]> storage;
+    uint32_t capacity; // power of two; kept while storage is released
+    uint32_t head;
+    uint32_t count;
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t in_flight_bytes;
+    uint32_t lost_segments;
+    uint32_t lost_hint; // at or before the lowest lost segment
+
+    uint32_t slot_of(size_t index) const {
+        return static_cast<uint32_t>((head + index) & (capacity - 1));
+    }
+
+    size_t index_of(uint32_t slot) const {
+        return slot == NONE ? count : ((slot - head) & (capacity - 1));
+    }
+
+    void link_newest(uint32_t slot) {
+        Record& record = storage[slot];
+        record.prev = newest;
+        record.next = NONE;
+        if (newest != NONE) {
+            storage[newest].next = slot;
+        }
+        else {
+            oldest = slot;
+        }
+        newest = slot;
+        in_flight_bytes += record.segment.end_seq - record.segment.seq;
+    }
+
+    void unlink(uint32_t slot) {
+        Record& record = storage[slot];
+        if (record.prev != NONE) {
+            storage[record.prev].next = record.next;
+        }
+        else {
+            oldest = record.next;
+        }
+        if (record.next != NONE) {
+            storage[record.next].prev = record.prev;
+        }
+        else {
+            newest = record.prev;
+        }
+        in_flight_bytes -= record.segment.end_seq - record.segment.seq;
+    }
+
+    void reserve(size_t needed) {
+        if (storage && needed <= capacity) {
+            return;
+        }
+        size_t new_capacity = capacity != 0 ? capacity : MIN_CAPACITY;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        std::unique_ptr<Record[]> grown(new Record[new_capacity]);
+        for (size_t i = 0; storage && i < count; i++) {
+            // Slot i in the new ring holds index i: relink by index
+            Record& record = storage[slot_of(i)];
+            grown[i] = record;
+            grown[i].prev = record.prev == NONE ? NONE : static_cast<uint32_t>(index_of(record.prev));
+            grown[i].next = record.next == NONE ? NONE : static_cast<uint32_t>(index_of(record.next));
+        }
+        if (storage) {
+            oldest = oldest == NONE ? NONE : static_cast<uint32_t>(index_of(oldest));
+            newest = newest == NONE ? NONE : static_cast<uint32_t>(index_of(newest));
+        }
+        storage = std::move(grown);
+        capacity = static_cast<uint32_t>(new_capacity);
+        head = 0;
+    }
+};
+
+#endif // RETRANSMITQUEUE_H
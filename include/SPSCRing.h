@@ -0,0 +1,133 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free single-producer, single-consumer ring for handing
+// packet handles (pointers, buffer indices, small structs) from one thread
+// to another. The producer publishes slots with a release store of the
+// tail and the consumer frees them with a release store of the head. Each
+// side keeps its own index and a cached copy of the other's on a cache line
+// of its own, and only reloads the other index when the ring looks full (or
+// empty), so in steady state the shared lines move once per burst rather
+// than once per entry. The burst calls move up to `count` entries with one
+// index update.
+template <typename T>
+class SPSCRing {
+public:
+    // The capacity is rounded up to a power of two.
+    explicit SPSCRing(size_t capacity = 1024)
+        : mask(static_cast<uint32_t>(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)),
+        slots(new T[mask + 1]) {
+        producer.tail.store(0, std::memory_order_relaxed);
+        producer.cached_head = 0;
+        consumer.head.store(0, std::memory_order_relaxed);
+        consumer.cached_tail = 0;
+    }
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    // Producer side. False when the ring is full.
+    bool push(T entry) {
+        uint32_t tail = producer.tail.load(std::memory_order_relaxed);
+        if (tail - producer.cached_head > mask) {
+            producer.cached_head = consumer.head.load(std::memory_order_acquire);
+            if (tail - producer.cached_head > mask) {
+                return false;
+            }
+        }
+        slots[tail & mask] = std::move(entry);
+        producer.tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side. Enqueues as many of `entries` as fit; returns the count.
+    size_t enqueue_burst(const T* entries, size_t count) {
+        uint32_t tail = producer.tail.load(std::memory_order_relaxed);
+        size_t free_slots = mask + 1 - (tail - producer.cached_head);
+        if (free_slots < count) {
+            producer.cached_head = consumer.head.load(std::memory_order_acquire);
+            free_slots = mask + 1 - (tail - producer.cached_head);
+            count = std::min(count, free_slots);
+        }
+        if (count == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < count; i++) {
+            slots[(tail + i) & mask] = entries[i];
+        }
+        producer.tail.store(tail + static_cast<uint32_t>(count), std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side. False when the ring is empty.
+    bool pop(T& entry) {
+        uint32_t head = consumer.head.load(std::memory_order_relaxed);
+        if (head == consumer.cached_tail) {
+            consumer.cached_tail = producer.tail.load(std::memory_order_acquire);
+            if (head == consumer.cached_tail) {
+                return false;
+            }
+        }
+        entry = std::move(slots[head & mask]);
+        consumer.head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Dequeues up to `max_count` entries; returns the count.
+    size_t dequeue_burst(T* entries, size_t max_count) {
+        uint32_t head = consumer.head.load(std::memory_order_relaxed);
+        size_t available = consumer.cached_tail - head;
+        if (available < max_count) {
+            consumer.cached_tail = producer.tail.load(std::memory_order_acquire);
+            available = consumer.cached_tail - head;
+        }
+        size_t count = std::min(available, max_count);
+        if (count == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < count; i++) {
+            entries[i] = std::move(slots[(head + i) & mask]);
+        }
+        consumer.head.store(head + static_cast<uint32_t>(count), std::memory_order_release);
+        return count;
+    }
+
+    // Exact only when called by one side while the other is idle.
+    size_t size() const {
+        return producer.tail.load(std::memory_order_acquire) - consumer.head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct alignas(64) Producer {
+        std::atomic<uint32_t> tail; // next slot to fill
+        uint32_t cached_head;
+    };
+
+    struct alignas(64) Consumer {
+        std::atomic<uint32_t> head; // next slot to consume
+        uint32_t cached_tail;
+    };
+
+    Producer producer;
+    Consumer consumer;
+    const uint32_t mask;
+    std::unique_ptr<T[]> slots;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,164 @@
+#ifndef SEGMENTATIONOFFLOAD_H
+#define SEGMENTATIONOFFLOAD_H
+
+#include "Checksum.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Software segmentation offload. The sender serializes a single
+// Ethernet + IPv4 + TCP header for a large send (the template) and each
+// MSS-sized piece gets a copy with its sequence number, IP ID, lengths and
+// checksums patched, instead of building a TCPSegment, IPPacket and
+// EthernetFrame per segment. The IP header checksum is updated
+// incrementally (RFC 1624); the TCP checksum reuses the template's
+// precomputed header sum and only adds the per-segment fields and payload.
+// UDP (GSO) works the same way, cutting a buffer into equal datagrams.
+class SegmentationOffload {
+public:
+    static const size_t MAX_SEND_SIZE = 65536; // largest send handed down at once
+
+    // Appends one frame per `mss` bytes of payload to `frames` and returns
+    // how many were added. PSH and FIN in the template go on the last frame
+    // only and CWR on the first (as hardware TSO with ECN does).
+    static size_t segment_tcp(const std::vector<uint8_t>& header, const uint8_t* payload, size_t length, uint16_t mss, std::vector<std::vector<uint8_t>>& frames) {
+        if (mss == 0) {
+            return 0; // no frame could carry any payload
+        }
+        const size_t ip_offset = ETHERNET_HEADER_LENGTH;
+        size_t ip_header_length = (header[ip_offset] & 0x0F) * 4;
+        size_t tcp_offset = ip_offset + ip_header_length;
+        size_t tcp_header_length = (header[tcp_offset + 12] >> 4) * 4;
+        size_t header_length = tcp_offset + tcp_header_length;
+
+        uint16_t template_total_length = get16(&header[ip_offset + 2]);
+        uint16_t template_id = get16(&header[ip_offset + 4]);
+        uint16_t template_ip_checksum = get16(&header[ip_offset + 10]);
+        uint32_t template_seq = get32(&header[tcp_offset + 4]);
+        uint8_t template_flags = header[tcp_offset + 13];
+
+        // Sum of the pseudo-header addresses and protocol plus the TCP header
+        // with the sequence number, flags and checksum taken out
+        uint8_t tcp_header[60];
+        memcpy(tcp_header, &header[tcp_offset], tcp_header_length);
+        memset(tcp_header + 4, 0, 4);
+        tcp_header[13] = 0;
+        memset(tcp_header + 16, 0, 2);
+        uint32_t header_sum = Checksum::pseudo_header(&header[ip_offset + 12], &header[ip_offset + 16], header[ip_offset + 9], 0);
+        header_sum = Checksum::add(tcp_header, tcp_header_length, header_sum);
+
+        size_t count = 0;
+        for (size_t offset = 0; offset < length; offset += mss) {
+            size_t piece = std::min<size_t>(mss, length - offset);
+            bool last = offset + piece == length;
+
+            std::vector<uint8_t> frame(header_length + piece);
+            memcpy(frame.data(), header.data(), header_length);
+            memcpy(frame.data() + header_length, payload + offset, piece);
+
+            uint16_t total_length = static_cast<uint16_t>(ip_header_length + tcp_header_length + piece);
+            uint16_t id = static_cast<uint16_t>(template_id + count);
+            uint16_t ip_checksum = Checksum::update16(template_ip_checksum, template_total_length, total_length);
+            ip_checksum = Checksum::update16(ip_checksum, template_id, id);
+            put16(&frame[ip_offset + 2], total_length);
+            put16(&frame[ip_offset + 4], id);
+            put16(&frame[ip_offset + 10], ip_checksum);
+
+            uint32_t seq = template_seq + static_cast<uint32_t>(offset);
+            uint8_t flags = last ? template_flags : static_cast<uint8_t>(template_flags & ~LAST_SEGMENT_FLAGS);
+            if (offset != 0) {
+                flags &= static_cast<uint8_t>(~FIRST_SEGMENT_FLAGS);
+            }
+            put32(&frame[tcp_offset + 4], seq);
+            frame[tcp_offset + 13] = flags;
+
+            uint32_t sum = Checksum::add32(seq, header_sum);
+            sum = Checksum::add16(static_cast<uint16_t>(tcp_header_length + piece), sum);
+            sum = Checksum::add16(flags, sum);
+            sum = Checksum::add(payload + offset, piece, sum);
+            put16(&frame[tcp_offset + 16], Checksum::fold(sum));
+
+            frames.push_back(std::move(frame));
+            count++;
+        }
+        return count;
+    }
+
+    // Appends one datagram per `segment_size` bytes of payload (the last may
+    // be shorter) to `frames` from an Ethernet + IPv4 + UDP template, and
+    // returns how many were added. A zero UDP checksum in the template
+    // means the datagrams go out without one.
+    static size_t segment_udp(const std::vector<uint8_t>& header, const uint8_t* payload, size_t length, size_t segment_size, std::vector<std::vector<uint8_t>>& frames) {
+        const size_t ip_offset = ETHERNET_HEADER_LENGTH;
+        size_t ip_header_length = (header[ip_offset] & 0x0F) * 4;
+        size_t udp_offset = ip_offset + ip_header_length;
+        size_t header_length = udp_offset + 8;
+
+        uint16_t template_total_length = get16(&header[ip_offset + 2]);
+        uint16_t template_id = get16(&header[ip_offset + 4]);
+        uint16_t template_ip_checksum = get16(&header[ip_offset + 10]);
+        bool checksum = get16(&header[udp_offset + 6]) != 0;
+
+        // Pseudo-header addresses and protocol plus the ports
+        uint32_t header_sum = Checksum::pseudo_header(&header[ip_offset + 12], &header[ip_offset + 16], header[ip_offset + 9], 0);
+        header_sum = Checksum::add(&header[udp_offset], 4, header_sum);
+
+        size_t count = 0;
+        for (size_t offset = 0; offset < length; offset += segment_size) {
+            size_t piece = std::min(segment_size, length - offset);
+
+            std::vector<uint8_t> frame(header_length + piece);
+            memcpy(frame.data(), header.data(), header_length);
+            memcpy(frame.data() + header_length, payload + offset, piece);
+
+            uint16_t udp_length = static_cast<uint16_t>(8 + piece);
+            uint16_t total_length = static_cast<uint16_t>(ip_header_length + udp_length);
+            uint16_t id = static_cast<uint16_t>(template_id + count);
+            uint16_t ip_checksum = Checksum::update16(template_ip_checksum, template_total_length, total_length);
+            ip_checksum = Checksum::update16(ip_checksum, template_id, id);
+            put16(&frame[ip_offset + 2], total_length);
+            put16(&frame[ip_offset + 4], id);
+            put16(&frame[ip_offset + 10], ip_checksum);
+            put16(&frame[udp_offset + 4], udp_length);
+
+            if (checksum) {
+                // The length counts twice: pseudo-header and UDP header
+                uint32_t sum = Checksum::add16(udp_length, Checksum::add16(udp_length, header_sum));
+                uint16_t udp_checksum = Checksum::fold(Checksum::add(payload + offset, piece, sum));
+                put16(&frame[udp_offset + 6], udp_checksum != 0 ? udp_checksum : 0xFFFF);
+            }
+
+            frames.push_back(std::move(frame));
+            count++;
+        }
+        return count;
+    }
+
+private:
+    static const size_t ETHERNET_HEADER_LENGTH = 14;
+    static const uint8_t LAST_SEGMENT_FLAGS = 0x01 | 0x08; // FIN | PSH
+    static const uint8_t FIRST_SEGMENT_FLAGS = 0x80;       // CWR
+
+    static uint16_t get16(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = v >> 8;
+        p[1] = v & 0xFF;
+    }
+
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = (v >> 16) & 0xFF;
+        p[2] = (v >> 8) & 0xFF;
+        p[3] = v & 0xFF;
+    }
+};
+
+#endif // SEGMENTATIONOFFLOAD_H
@@ -0,0 +1,211 @@
+#ifndef SENDBUFFER_H
+#define SENDBUFFER_H
+
+#include "ByteRing.h"
+#include "CompletionQueue.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// A connection's send queue: a byte stream from snd_una onwards, read by
+// offset when segments are built and retransmitted. Copied data lives in a
+// ByteRing. Zero-copy sends append a reference to application memory
+// instead; the buffer must stay unchanged until its id is reported on the
+// completion queue, which happens once every byte of it has been consumed
+// (acknowledged). While no reference is queued the stream is just the ring.
+class SendBuffer {
+public:
+    SendBuffer() {}
+
+    // References still queued are released undelivered.
+    ~SendBuffer() {
+        if (references) {
+            for (const auto& extent : references->extents) {
+                if (extent.data && references->completions) {
+                    references->completions->push(extent.id, false);
+                }
+            }
+        }
+    }
+
+    SendBuffer(const SendBuffer&) = delete;
+    SendBuffer& operator=(const SendBuffer&) = delete;
+
+    // Zero-copy sends report to `completions`; required before append_reference().
+    void set_completion_queue(CompletionQueue* completions) {
+        zero_copy_state().completions = completions;
+    }
+
+    size_t size() const {
+        return ring.size() + (references ? references->bytes : 0);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    uint8_t operator[](size_t offset) const {
+        uint8_t byte;
+        copy(offset, 1, &byte);
+        return byte;
+    }
+
+    void append(const uint8_t* data, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        if (references && !references->extents.empty()) {
+            std::deque<Extent>& extents = references->extents;
+            if (extents.back().data) {
+                extents.push_back({ nullptr, 0, 0 });
+            }
+            extents.back().length += length;
+        }
+        ring.append(data, length);
+    }
+
+    void append(const std::vector<uint8_t>& data) {
+        append(data.data(), data.size());
+    }
+
+    // Queues `length` bytes of application memory without copying them.
+    // False without a completion queue.
+    bool append_reference(const uint8_t* data, size_t length, uint64_t id) {
+        if (!references || !references->completions) {
+            return false;
+        }
+        if (length == 0) {
+            references->completions->push(id, true);
+            return true;
+        }
+        std::deque<Extent>& extents = references->extents;
+        if (extents.empty() && !ring.empty()) {
+            extents.push_back({ nullptr, ring.size(), 0 });
+        }
+        extents.push_back({ data, length, id });
+        references->bytes += length;
+        return true;
+    }
+
+    // Copies `length` bytes starting `offset` bytes past the front.
+    void copy(size_t offset, size_t length, uint8_t* dest) const {
+        if (!references || references->extents.empty()) {
+            ring.copy(offset, length, dest);
+            return;
+        }
+        size_t ring_offset = 0;
+        for (const auto& extent : references->extents) {
+            if (length == 0) {
+                break;
+            }
+            if (offset < extent.length) {
+                size_t part = std::min(length, extent.length - offset);
+                if (extent.data) {
+                    memcpy(dest, extent.data + offset, part);
+                }
+                else {
+                    ring.copy(ring_offset + offset, part, dest);
+                }
+                dest += part;
+                length -= part;
+                offset = 0;
+            }
+            else {
+                offset -= extent.length;
+            }
+            if (!extent.data) {
+                ring_offset += extent.length;
+            }
+        }
+    }
+
+    std::vector<uint8_t> copy(size_t offset, size_t length) const {
+        std::vector<uint8_t> data(length);
+        copy(offset, length, data.data());
+        return data;
+    }
+
+    // Application memory holding the whole range, when it lies within one
+    // zero-copy send; nullptr otherwise.
+    const uint8_t* contiguous(size_t offset, size_t length) const {
+        if (!references) {
+            return nullptr;
+        }
+        for (const auto& extent : references->extents) {
+            if (offset < extent.length) {
+                return extent.data && offset + length <= extent.length ? extent.data + offset : nullptr;
+            }
+            offset -= extent.length;
+        }
+        return nullptr;
+    }
+
+    // Drops `length` bytes from the front, completing the zero-copy sends
+    // they finish.
+    void consume(size_t length) {
+        if (!references || references->extents.empty()) {
+            ring.consume(length);
+            return;
+        }
+        std::deque<Extent>& extents = references->extents;
+        while (length > 0 && !extents.empty()) {
+            Extent& extent = extents.front();
+            size_t part = std::min(length, extent.length);
+            if (extent.data) {
+                extent.data += part;
+                references->bytes -= part;
+            }
+            else {
+                ring.consume(part);
+            }
+            extent.length -= part;
+            length -= part;
+            if (extent.length == 0) {
+                if (extent.data) {
+                    references->completions->push(extent.id, true);
+                }
+                extents.pop_front();
+            }
+        }
+        if (references->bytes == 0) {
+            extents.clear(); // only ring bytes are left
+        }
+    }
+
+    // Frees the ring's storage while nothing is queued.
+    void release() {
+        ring.release();
+    }
+
+private:
+    // A run of the stream: application memory, or (data == nullptr) the
+    // next `length` bytes of the ring
+    struct Extent {
+        const uint8_t* data;
+        size_t length;
+        uint64_t id;
+    };
+
+    // Allocated when a completion queue is set
+    struct References {
+        std::deque<Extent> extents; // the whole stream in order; empty while it is just the ring
+        CompletionQueue* completions = nullptr;
+        size_t bytes = 0; // referenced bytes queued
+    };
+
+    ByteRing ring;
+    std::unique_ptr<References> references;
+
+    References& zero_copy_state() {
+        if (!references) {
+            references.reset(new References());
+        }
+        return *references;
+    }
+};
+
+#endif // SENDBUFFER_H
@@ -0,0 +1,189 @@
+#ifndef SHARDEDSTACK_H
+#define SHARDEDSTACK_H
+
+#include "Stack.h"
+#include "Toeplitz.h"
+#include "Link.h"
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// One local address served by N shared-nothing copies of the stack, one per
+// core. Each shard is a Stack on its own link queue, with its own connection
+// table, timer wheel, UDP endpoints and frame buffers, run by its own
+// thread; nothing is shared on the per-packet path.
+//
+// Received frames are steered as with NIC receive-side scaling: the
+// Toeplitz hash of the IPv4 4-tuple (address pair only for other protocols
+// and fragments) indexes an indirection table naming the shard; non-IPv4
+// frames (ARP) go to shard 0. A multi-queue NIC is programmed with
+// get_hash().get_key() and get_indirection_table() and does this itself; a
+// software dispatcher in front of a single-queue device calls steer() and
+// feeds each shard a RingLink.
+//
+// The default key makes the hash symmetric, so both directions of a flow
+// land on one shard. A connection a shard opens must take its local port
+// from pick_local_port(), which only returns ports whose replies steer back
+// to that shard. Servers listen on every shard, one TCPListener each (as
+// with SO_REUSEPORT).
+class ShardedStack {
+public:
+    static const size_t INDIRECTION_TABLE_SIZE = 128;
+
+    // One shard per queue; queue i is served by shard i.
+    ShardedStack(uint32_t local_ip, const std::vector<Link*>& queues, const ToeplitzHash& hash = ToeplitzHash())
+        : local_ip(local_ip),
+        hash(hash),
+        indirection(INDIRECTION_TABLE_SIZE) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            shards.emplace_back(new Shard(local_ip, *queues[i]));
+        }
+        for (size_t i = 0; i < INDIRECTION_TABLE_SIZE; i++) {
+            indirection[i] = static_cast<uint16_t>(i % queues.size());
+        }
+    }
+
+    ~ShardedStack() {
+        stop();
+    }
+
+    ShardedStack(const ShardedStack&) = delete;
+    ShardedStack& operator=(const ShardedStack&) = delete;
+
+    // Runs every shard's Stack::run() on a thread of its own; with
+    // `pin_threads` shard i stays on CPU i (modulo the CPU count).
+    void start(bool pin_threads = true) {
+        size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < shards.size(); i++) {
+            Shard& shard = *shards[i];
+            if (shard.thread.joinable()) {
+                continue;
+            }
+            size_t cpu = pin_threads ? i % cpus : SIZE_MAX;
+            shard.thread = std::thread([&shard, cpu] {
+                if (cpu != SIZE_MAX) {
+                    pin_to_cpu(cpu);
+                }
+                shard.stack.run();
+            });
+        }
+    }
+
+    // Stops and joins the shard threads.
+    void stop() {
+        for (auto& shard : shards) {
+            if (shard->thread.joinable()) {
+                shard->stack.stop();
+                shard->thread.join();
+            }
+        }
+    }
+
+    size_t size() const {
+        return shards.size();
+    }
+
+    // Shard i's stack; touch it only from its thread while the shards run.
+    Stack& get_shard(size_t index) {
+        return shards[index]->stack;
+    }
+
+    // Shard for a frame received from the wire.
+    size_t steer(const std::vector<uint8_t>& frame) const {
+        const size_t ip = 14;
+        if (frame.size() < ip + 20 || ((frame[12] << 8) | frame[13]) != 0x0800 || (frame[ip] >> 4) != 4) {
+            return 0;
+        }
+        uint32_t src_ip = get32(&frame[ip + 12]);
+        uint32_t dest_ip = get32(&frame[ip + 16]);
+        size_t ip_header_length = (frame[ip] & 0x0F) * 4;
+        uint8_t protocol = frame[ip + 9];
+        bool fragment = ((frame[ip + 6] << 8) | frame[ip + 7]) & 0x3FFF;
+        if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) && !fragment && ip_header_length >= 20
+            && frame.size() >= ip + ip_header_length + 4) {
+            const uint8_t* ports = &frame[ip + ip_header_length];
+            return shard_for(src_ip, dest_ip, static_cast<uint16_t>((ports[0] << 8) | ports[1]), static_cast<uint16_t>((ports[2] << 8) | ports[3]));
+        }
+        return indirection[hash.hash_ipv4(src_ip, dest_ip) & (INDIRECTION_TABLE_SIZE - 1)];
+    }
+
+    // Shard for a frame from (src_ip, src_port) to (dest_ip, dest_port).
+    size_t shard_for(uint32_t src_ip, uint32_t dest_ip, uint16_t src_port, uint16_t dest_port) const {
+        return indirection[hash.hash_ipv4(src_ip, dest_ip, src_port, dest_port) & (INDIRECTION_TABLE_SIZE - 1)];
+    }
+
+    // An ephemeral port, free in the shard for this remote end, whose
+    // traffic from (remote_ip, remote_port) steers to the shard; 0 when
+    // there is none. Call it from the shard's thread.
+    uint16_t pick_local_port(size_t index, uint32_t remote_ip, uint16_t remote_port) {
+        Shard& shard = *shards[index];
+        for (uint32_t tries = 0; tries <= UDPLayer::EPHEMERAL_PORT_MAX - UDPLayer::EPHEMERAL_PORT_MIN; tries++) {
+            uint16_t port = shard.next_port;
+            shard.next_port = port == UDPLayer::EPHEMERAL_PORT_MAX ? UDPLayer::EPHEMERAL_PORT_MIN : static_cast<uint16_t>(port + 1);
+            if (shard_for(remote_ip, local_ip, remote_port, port) != index) {
+                continue;
+            }
+            if (shard.stack.get_connection_table().find_connection(remote_ip, remote_port, local_ip, port)
+                || shard.stack.get_udp().is_bound(port)) {
+                continue;
+            }
+            return port;
+        }
+        return 0;
+    }
+
+    const ToeplitzHash& get_hash() const {
+        return hash;
+    }
+
+    // Hash (low 7 bits) -> shard, for programming a NIC's RSS table
+    const std::vector<uint16_t>& get_indirection_table() const {
+        return indirection;
+    }
+
+private:
+    // Aligned so that no two shards share a cache line
+    struct alignas(64) Shard {
+        Shard(uint32_t local_ip, Link& queue)
+            : stack(local_ip, queue),
+            next_port(UDPLayer::EPHEMERAL_PORT_MIN) {}
+
+        Stack stack;
+        std::thread thread;
+        uint16_t next_port; // where pick_local_port() resumes
+    };
+
+    uint32_t local_ip;
+    ToeplitzHash hash;
+    std::vector<uint16_t> indirection;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    static void pin_to_cpu(size_t cpu) {
+#ifdef _WIN32
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)cpu;
+#endif
+    }
+};
+
+#endif // SHARDEDSTACK_H
@@ -3,57 +3,144 @@
 #define SOCKET_H
 
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include "UDPLayer.h"
+#include "CompletionQueue.h"
 
 enum SocketType {
     SOCKET_TYPE_UDP,
     SOCKET_TYPE_TCP
 };
 
+// Datagram socket on a UDPLayer. Addresses in the string calls are dotted
+// quads; the batch calls (after sendmmsg / recvmmsg) take UDPDatagram
+// addresses as for the IPPacket constructor. Only UDP sockets carry data.
+// Register get_poll_source() with an EventPoller to wait for datagrams.
 class Socket {
 public:
-    Socket(SocketType type);
-    ~Socket();
+    Socket(SocketType type, UDPLayer* udp = nullptr) : type(type), udp(udp), bound_port(0), completions(nullptr) {
+        readiness.set_events(usable() ? EventPoller::WRITABLE : EventPoller::FAILURE);
+    }
 
-    bool bind(uint16_t port);
-    bool sendto(const std::vector<uint8_t>& data, const std::string& dest_ip, uint16_t dest_port);
-    bool recvfrom(std::vector<uint8_t>& data, std::string& src_ip, uint16_t& src_port);
+    ~Socket() {
+        if (bound_port != 0) {
+            udp->unbind(bound_port);
+        }
+    }
 
-private:
-    SocketType type;
-    uint16_t bound_port;
-    std::vector<uint8_t> buffer;
-};
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    // Port 0 binds an ephemeral port.
+    bool bind(uint16_t port) {
+        if (!usable() || bound_port != 0) {
+            return false;
+        }
+        bound_port = udp->bind(port);
+        if (bound_port == 0) {
+            return false;
+        }
+        udp->set_poll_source(bound_port, &readiness);
+        return true;
+    }
+
+    bool sendto(const std::vector<uint8_t>& data, const std::string& dest_ip, uint16_t dest_port) {
+        uint32_t address;
+        if (!ensure_bound() || inet_pton(AF_INET, dest_ip.c_str(), &address) != 1) {
+            return false;
+        }
+        return udp->send(bound_port, address, dest_port, data.data(), data.size());
+    }
+
+    // Takes the oldest queued datagram; false when none is waiting.
+    bool recvfrom(std::vector<uint8_t>& data, std::string& src_ip, uint16_t& src_port) {
+        received.clear();
+        if (bound_port == 0 || udp->receive(bound_port, received, 1) == 0) {
+            return false;
+        }
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &received[0].ip, text, sizeof(text));
+        data = std::move(received[0].data);
+        src_ip = text;
+        src_port = received[0].port;
+        return true;
+    }
+
+    // Zero-copy completions go to `queue`; see send_zerocopy().
+    void set_completion_queue(CompletionQueue* queue) {
+        completions = queue;
+    }
 
-Socket::Socket(SocketType type) : type(type), bound_port(0) {}
+    // Sends `length` bytes of application memory as one datagram without an
+    // intermediate copy: the headers and payload are written straight into
+    // the frame. `id` is completed once the link has taken the frame
+    // (delivered) or refused it. False without a completion queue or when
+    // the datagram could not be sent.
+    bool send_zerocopy(const uint8_t* data, size_t length, const std::string& dest_ip, uint16_t dest_port, uint64_t id) {
+        uint32_t address;
+        if (!completions || !ensure_bound() || inet_pton(AF_INET, dest_ip.c_str(), &address) != 1) {
+            return false;
+        }
+        bool sent = udp->send(bound_port, address, dest_port, data, length);
+        completions->push(id, sent);
+        return sent;
+    }
+
+    // Sends the datagrams in one link burst; returns how many were sent.
+    size_t sendmmsg(const std::vector<UDPDatagram>& datagrams) {
+        if (!ensure_bound()) {
+            return 0;
+        }
+        return udp->send_batch(bound_port, datagrams);
+    }
+
+    // UDP segmentation offload: `data` goes out as datagrams of
+    // `segment_size` bytes (the last may be shorter) in one link burst, at
+    // most UDPLayer::MAX_SEGMENTS of them. Returns the datagrams sent.
+    size_t send_segmented(const std::vector<uint8_t>& data, size_t segment_size, const std::string& dest_ip, uint16_t dest_port) {
+        uint32_t address;
+        if (!ensure_bound() || inet_pton(AF_INET, dest_ip.c_str(), &address) != 1) {
+            return 0;
+        }
+        return udp->send_segmented(bound_port, address, dest_port, data.data(), data.size(), segment_size);
+    }
+
+    // Appends up to `max_datagrams` queued datagrams; returns the count.
+    size_t recvmmsg(std::vector<UDPDatagram>& datagrams, size_t max_datagrams) {
+        if (bound_port == 0) {
+            return 0;
+        }
+        return udp->receive(bound_port, datagrams, max_datagrams);
+    }
 
-Socket::~Socket() {}
+    uint16_t get_local_port() const {
+        return bound_port;
+    }
 
-bool Socket::bind(uint16_t port) {
-    bound_port = port;
-    return true;
-}
+    // READABLE while datagrams are queued; WRITABLE whenever the socket is usable.
+    EventPoller::Source& get_poll_source() {
+        return readiness;
+    }
 
-bool Socket::sendto(const std::vector<uint8_t>& data, const std::string& dest_ip, uint16_t dest_port) {
-    // ģⷢݣֻ̨
-    std::cout << "Sending data to " << dest_ip << ":" << dest_port << std::endl;
-    buffer = data; // ݴ뻺Թģʹ
-    return true;
-}
+private:
+    SocketType type;
+    UDPLayer* udp;
+    uint16_t bound_port;
+    CompletionQueue* completions;
+    std::vector<UDPDatagram> received;
+    EventPoller::Source readiness;
 
-bool Socket::recvfrom(std::vector<uint8_t>& data, std::string& src_ip, uint16_t& src_port) {
-    // ģݣӻȡݣ
-    if (buffer.empty()) {
-        return false;
+    bool usable() const {
+        return type == SOCKET_TYPE_UDP && udp != nullptr;
     }
 
-    data = buffer;
-    src_ip = "127.0.0.1"; // ģԴIP
-    src_port = bound_port; // ģԴ˿
-    buffer.clear();
-    return true;
-}
+    // Sending from an unbound socket binds an ephemeral port first.
+    bool ensure_bound() {
+        return bound_port != 0 || bind(0);
+    }
+};
 
 #endif // SOCKET_H
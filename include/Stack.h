@@ -0,0 +1,306 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include "Link.h"
+#include "TimerWheel.h"
+#include "NeighborCache.h"
+#include "UDPLayer.h"
+#include "ReceiveOffload.h"
+#include "TCPConnection.h"
+#include "TCPListener.h"
+#include "PacingQueue.h"
+#include "PacketGraph.h"
+#include "AsyncSocket.h"
+#include "StackServer.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Run-to-completion engine for one interface. Each round of poll() takes a
+// burst of frames from the device and carries every frame through all
+// layers before the next burst is read, by dispatching the burst through
+// the receive PacketGraph: UDP datagrams are queued on their endpoints, TCP
+// segments (merged by the receive offload) reach their connection or
+// listener, ARP requests for the local address and ICMP echo requests are
+// answered in place, and IPv4 fragments are reassembled on the stack's
+// timer wheel. Then due timers fire, paced frames whose time has come
+
+// are released, the attached EventLoop and StackServer run, and everything
+// the round sent leaves in one device burst.
+//
+// run() repeats rounds on the calling thread until stop(). While idle it
+// backs off in three steps: keep polling for `spin_time`, then yield the
+// CPU between rounds until `yield_time`, then block in the device's
+// wait_for_frames() for up to `max_sleep` (less while timers are armed or
+// frames are paced). A StackServer's applications are not a wake-up source
+// for the device, so their requests wait up to `max_sleep` once the loop
+// sleeps.
+//
+// Addresses are as for the IPPacket constructor. The layers share the
+// stack's timer wheel and send through get_link(); connections opened by
+// the application must do the same and join get_connection_table() with
+// TCPConnection::add_to_table().
+class Stack {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Stack(uint32_t local_ip, Link& device, size_t burst_size = 64)
+        : device(device),
+        local_ip(local_ip),
+        tx(device),
+        udp(local_ip, tx),
+        neighbors(timers),
+        reassembler(timers),
+        graph(local_ip, mac, tx, udp, offload, table, neighbors, reassembler),
+        pacing(nullptr),
+        event_loop(nullptr),
+        server(nullptr),
+        burst_size(burst_size),
+        spin_time(std::chrono::microseconds(50)),
+        yield_time(std::chrono::milliseconds(1)),
+        max_sleep(std::chrono::milliseconds(1)),
+        stop_requested(false),
+        frames_received(0),
+        iterations(0),
+        busy_iterations(0),
+        yields(0),
+        sleeps(0),
+        busy_time(0),
+        idle_time(0),
+        max_iteration_time(0) {}
+
+    Stack(const Stack&) = delete;
+    Stack& operator=(const Stack&) = delete;
+
+    // Frames paced through this queue are released each round. The queue
+    // should wrap the stack's device.
+    void set_pacing_queue(PacingQueue* queue) {
+        pacing = queue;
+    }
+
+    void set_event_loop(EventLoop* loop) {
+        event_loop = loop;
+    }
+
+    void set_server(StackServer* stack_server) {
+        server = stack_server;
+    }
+
+    // Idle backoff: poll without pausing for `spin`, yield until `yield`,
+    // then block for at most `sleep` at a time.
+    void set_backoff(Clock::duration spin, Clock::duration yield, std::chrono::microseconds sleep) {
+        spin_time = spin;
+        yield_time = std::max(spin, yield);
+        max_sleep = sleep;
+    }
+
+    // Runs rounds until stop() is called.
+    void run() {
+        Clock::time_point start = Clock::now();
+        Clock::time_point last_work = start;
+        while (!stop_requested.load(std::memory_order_relaxed)) {
+            size_t work = poll(start);
+            Clock::time_point end = Clock::now();
+            if (work > 0) {
+                busy_iterations++;
+                busy_time += end - start;
+                max_iteration_time = std::max(max_iteration_time, end - start);
+                last_work = end;
+            }
+            else {
+                backoff(end, end - last_work);
+                end = Clock::now();
+                idle_time += end - start;
+            }
+            iterations++;
+            start = end;
+        }
+        stop_requested.store(false, std::memory_order_relaxed);
+    }
+
+    // Makes run() return after the current round; callable from any thread.
+    void stop() {
+        stop_requested.store(true, std::memory_order_relaxed);
+    }
+
+    // One round; returns the frames, events and requests handled (0 when idle).
+    size_t poll(Clock::time_point now = Clock::now()) {
+        rx.clear();
+        size_t work = device.receive_burst(rx, burst_size);
+        if (work > 0) {
+            frames_received += work;
+            graph.dispatch(rx);
+        }
+        work += timers.advance(now);
+        if (pacing) {
+            work += pacing->poll(now);
+        }
+        if (event_loop) {
+            work += event_loop->poll();
+        }
+        if (server) {
+            work += server->poll();
+        }
+        work += tx.flush();
+        return work;
+    }
+
+    // Every layer and connection sends through this link.
+    TransmitBatcher& get_link() {
+        return tx;
+    }
+
+    TimerWheel& get_timers() {
+        return timers;
+    }
+
+    UDPLayer& get_udp() {
+        return udp;
+    }
+
+    TCPListener::Table& get_connection_table() {
+        return table;
+    }
+
+    // The receive path; set_max_vector(1) makes it per-packet.
+    PacketGraph& get_graph() {
+        return graph;
+    }
+
+    // IPv4 -> MAC mappings learnt from ARP traffic
+    NeighborCache<uint32_t>& get_neighbors() {
+        return neighbors;
+    }
+
+    uint32_t get_local_ip() const {
+        return local_ip;
+    }
+
+    uint64_t get_frames_received() const {
+        return frames_received;
+    }
+
+    // Frames no layer took: other protocols, or segments without a connection or listener
+    uint64_t get_frames_unhandled() const {
+        return graph.get_drops();
+    }
+
+    uint64_t get_arp_replies() const {
+        return graph.get_arp_replies();
+    }
+
+    uint64_t get_echo_replies() const {
+        return graph.get_echo_replies();
+    }
+
+    // Rounds run() has made, and those that found work
+    uint64_t get_iterations() const {
+        return iterations;
+    }
+
+    uint64_t get_busy_iterations() const {
+        return busy_iterations;
+    }
+
+    uint64_t get_yields() const {
+        return yields;
+    }
+
+    uint64_t get_sleeps() const {
+        return sleeps;
+    }
+
+    // Mean and longest duration of a round that found work
+    std::chrono::nanoseconds get_average_iteration_time() const {
+        if (busy_iterations == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(busy_time) / busy_iterations;
+    }
+
+    std::chrono::nanoseconds get_max_iteration_time() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(max_iteration_time);
+    }
+
+    // Share of run()'s time spent in idle rounds, backoff included
+    double get_idle_fraction() const {
+        Clock::duration total = busy_time + idle_time;
+        if (total.count() == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(idle_time.count()) / static_cast<double>(total.count());
+    }
+
+    void reset_metrics() {
+        iterations = 0;
+        busy_iterations = 0;
+        yields = 0;
+        sleeps = 0;
+        busy_time = Clock::duration(0);
+        idle_time = Clock::duration(0);
+        max_iteration_time = Clock::duration(0);
+    }
+
+private:
+    Link& device;
+    uint32_t local_ip;
+    uint8_t mac[6] = { 0x00, 0x0c, 0x29, 0x36, 0xbc, 0x17 }; // as the layers' frames
+    TransmitBatcher tx;
+    TimerWheel timers;
+    UDPLayer udp;
+    ReceiveOffload offload;
+    TCPListener::Table table;
+    NeighborCache<uint32_t> neighbors;
+    IPReassembler reassembler;
+    PacketGraph graph;
+    PacingQueue* pacing;
+    EventLoop* event_loop;
+    StackServer* server;
+    size_t burst_size;
+    Clock::duration spin_time;
+    Clock::duration yield_time;
+    std::chrono::microseconds max_sleep;
+    std::atomic<bool> stop_requested;
+    std::vector<std::vector<uint8_t>> rx; // per-round burst, reused
+    uint64_t frames_received;
+    uint64_t iterations;
+    uint64_t busy_iterations;
+    uint64_t yields;
+    uint64_t sleeps;
+    Clock::duration busy_time;
+    Clock::duration idle_time;
+    Clock::duration max_iteration_time;
+
+    void backoff(Clock::time_point now, Clock::duration idle) {
+        if (idle < spin_time) {
+            return;
+        }
+        if (idle < yield_time) {
+            std::this_thread::yield();
+            yields++;
+            return;
+        }
+        std::chrono::microseconds timeout = max_sleep;
+        if (!timers.empty()) {
+            timeout = std::min(timeout, timers.tick());
+        }
+        if (pacing && pacing->pending() > 0) {
+            Clock::time_point departure = pacing->next_departure();
+            if (departure <= now) {
+                return;
+            }
+            timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::microseconds>(departure - now));
+        }
+        if (timeout.count() > 0) {
+            device.wait_for_frames(timeout);
+            sleeps++;
+        }
+    }
+};
+
+#endif // STACK_H
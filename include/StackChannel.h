@@ -0,0 +1,528 @@
+#ifndef STACKCHANNEL_H
+#define STACKCHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <ctime>
+#endif
+#endif
+
+// Operations on a channel. An application posts requests with the codes up
+// to CHANNEL_CLOSE; the stack answers each (except CHANNEL_RELEASE) with a
+// completion carrying the same code, and posts the last three on its own.
+enum ChannelOp : uint8_t {
+    CHANNEL_OPEN = 1,   // type = SOCKET_TYPE_UDP or SOCKET_TYPE_TCP
+    CHANNEL_BIND,       // port; result = bound port (0 picks one), or -1
+    CHANNEL_LISTEN,     // TCP, port; length = backlog
+    CHANNEL_CONNECT,    // ip, port; TCP completes once established
+    CHANNEL_SEND,       // buffer, length, UDP also ip, port; completes when the buffer is free again
+    CHANNEL_RELEASE,    // buffer: hands a received buffer back to the stack
+    CHANNEL_CLOSE,
+    CHANNEL_RECEIVED,   // buffer, length, ip, port; result = datagram length before truncation
+    CHANNEL_ACCEPTED,   // handle = the new connection; result = listening handle; ip, port = peer
+    CHANNEL_HANGUP      // peer closed or the connection failed; nothing more will arrive
+};
+
+// One slot of the request ring (application to stack).
+struct ChannelRequest {
+    uint8_t op;
+    uint8_t type;
+    uint16_t port;
+    uint32_t handle;
+    uint32_t ip;
+    uint32_t buffer;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+// One slot of the completion ring (stack to application).
+struct ChannelCompletion {
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t port;
+    uint32_t handle;
+    uint32_t ip;
+    uint32_t buffer;
+    uint32_t length;
+    int32_t result; // 0 or positive on success, -1 on failure
+};
+
+// Indices of a ring in shared memory. Producer and consumer each write one
+// cache line, so the two sides never write the same line.
+struct RingControl {
+    alignas(64) std::atomic<uint32_t> head; // next slot to consume
+    alignas(64) std::atomic<uint32_t> tail; // next slot to fill
+};
+
+// One process's view of a single-producer, single-consumer ring in shared
+// memory. The producer publishes slots with a release store of the tail and
+// the consumer frees them with a release store of the head; each side keeps
+// a private copy of the other's index and only reloads it when the ring
+// looks full (or empty), so the shared lines move only when needed.
+template <typename T>
+class ChannelRing {
+public:
+    ChannelRing() : control(nullptr), slots(nullptr), capacity(0), cached_head(0), cached_tail(0) {}
+
+    ChannelRing(const ChannelRing&) = delete;
+    ChannelRing& operator=(const ChannelRing&) = delete;
+
+    // `capacity` must be a power of two.
+    void attach(RingControl* ring, T* entries, uint32_t slot_count) {
+        control = ring;
+        slots = entries;
+        capacity = slot_count;
+        cached_head = control->head.load(std::memory_order_acquire);
+        cached_tail = control->tail.load(std::memory_order_acquire);
+    }
+
+    bool push(const T& entry) {
+        uint32_t tail = control->tail.load(std::memory_order_relaxed);
+        if (tail - cached_head == capacity) {
+            cached_head = control->head.load(std::memory_order_acquire);
+            if (tail - cached_head == capacity) {
+                return false;
+            }
+        }
+        slots[tail & (capacity - 1)] = entry;
+        control->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& entry) {
+        uint32_t head = control->head.load(std::memory_order_relaxed);
+        if (head == cached_tail) {
+            cached_tail = control->tail.load(std::memory_order_acquire);
+            if (head == cached_tail) {
+                return false;
+            }
+        }
+        entry = slots[head & (capacity - 1)];
+        control->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Slots the producer can fill without waiting.
+    uint32_t free_slots() {
+        uint32_t tail = control->tail.load(std::memory_order_relaxed);
+        if (tail - cached_head == capacity) {
+            cached_head = control->head.load(std::memory_order_acquire);
+        }
+        return capacity - (tail - cached_head);
+    }
+
+    bool empty() const {
+        return control->head.load(std::memory_order_relaxed) == control->tail.load(std::memory_order_acquire);
+    }
+
+    uint32_t get_capacity() const {
+        return capacity;
+    }
+
+private:
+    RingControl* control;
+    T* slots;
+    uint32_t capacity;
+    uint32_t cached_head; // producer's copy
+    uint32_t cached_tail; // consumer's copy
+};
+
+// Shared part of a Doorbell
+struct DoorbellState {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> sleepers;
+};
+
+// Wakes a process sleeping on a ring. Producers call notify() after
+// publishing; it is a fence and a load unless the consumer is asleep, so a
+// busy-polling pair never enters the kernel. A consumer that found its ring
+// empty may wait(); on Linux it sleeps on a futex in the shared page (no
+// descriptor to pass between processes), on Windows on a named event, and
+// elsewhere it naps in 100 us steps.
+class Doorbell {
+public:
+    Doorbell() : state(nullptr) {
+#ifdef _WIN32
+        event = nullptr;
+#endif
+    }
+
+    ~Doorbell() {
+#ifdef _WIN32
+        if (event) {
+            CloseHandle(event);
+        }
+#endif
+    }
+
+    Doorbell(const Doorbell&) = delete;
+    Doorbell& operator=(const Doorbell&) = delete;
+
+    // `name` identifies the doorbell between processes where the OS needs one.
+    void attach(DoorbellState* shared, const std::string& name) {
+        state = shared;
+#ifdef _WIN32
+        event = CreateEventA(nullptr, FALSE, FALSE, ("Local\\" + name).c_str());
+#else
+        (void)name;
+#endif
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (state->sleepers.load(std::memory_order_relaxed) != 0) {
+            state->sequence.fetch_add(1, std::memory_order_seq_cst);
+#ifdef _WIN32
+            SetEvent(event);
+#elif defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state->sequence), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+    }
+
+    // Sleeps until notify() or `timeout_ms`, unless ready() already holds.
+    // ready() is rechecked after announcing the sleep, so a notify() racing
+    // with the check is never lost.
+    template <typename Ready>
+    void wait(Ready ready, uint32_t timeout_ms) {
+        state->sleepers.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t seen = state->sequence.load(std::memory_order_seq_cst);
+        if (!ready()) {
+#ifdef _WIN32
+            (void)seen;
+            WaitForSingleObject(event, timeout_ms);
+#elif defined(__linux__)
+            timespec timeout = { static_cast<time_t>(timeout_ms / 1000), static_cast<long>(timeout_ms % 1000) * 1000000 };
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state->sequence), FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#else
+            for (uint32_t waited = 0; waited < timeout_ms * 10 && state->sequence.load() == seen; waited++) {
+                usleep(100);
+            }
+#endif
+        }
+        state->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+private:
+    DoorbellState* state;
+#ifdef _WIN32
+    HANDLE event;
+#endif
+};
+
+// Named memory shared between processes: POSIX shared memory, or a
+// page-file backed mapping on Windows. The creator removes the name when it
+// unmaps; mappings already open stay valid.
+class SharedRegion {
+public:
+    SharedRegion() : base(nullptr), length(0), owner(false) {
+#ifdef _WIN32
+        mapping = nullptr;
+#endif
+    }
+
+    ~SharedRegion() {
+        close();
+    }
+
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    // Creates `size` zeroed bytes under `name`, replacing a region left
+    // behind by a process that died.
+    bool create(const std::string& name, size_t size) {
+        close();
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+            static_cast<DWORD>(size), ("Local\\" + name).c_str());
+        if (!mapping) {
+            return false;
+        }
+        base = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+        std::string path = "/" + name;
+        int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            shm_unlink(path.c_str());
+            fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            base = address != MAP_FAILED ? static_cast<uint8_t*>(address) : nullptr;
+        }
+        ::close(fd);
+        if (!base) {
+            shm_unlink(path.c_str());
+        }
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        this->name = name;
+        length = size;
+        owner = true;
+        return true;
+    }
+
+    bool open(const std::string& name) {
+        close();
+#ifdef _WIN32
+        mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ("Local\\" + name).c_str());
+        if (!mapping) {
+            return false;
+        }
+        base = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+        MEMORY_BASIC_INFORMATION info;
+        if (base && VirtualQuery(base, &info, sizeof(info)) == sizeof(info)) {
+            length = info.RegionSize;
+        }
+#else
+        int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) == 0 && status.st_size > 0) {
+            void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED) {
+                base = static_cast<uint8_t*>(address);
+                length = static_cast<size_t>(status.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        this->name = name;
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (base) {
+            UnmapViewOfFile(base);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+#else
+        if (base) {
+            munmap(base, length);
+        }
+        if (owner) {
+            shm_unlink(("/" + name).c_str());
+        }
+#endif
+        base = nullptr;
+        length = 0;
+        owner = false;
+    }
+
+    uint8_t* data() const {
+        return base;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    uint8_t* base;
+    size_t length;
+    bool owner;
+    std::string name;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
+
+// The memory one application shares with the stack: a request ring, a
+// completion ring and a pool of fixed-size packet buffers, with a doorbell
+// for each direction. The region holds no pointers, only offsets, so each
+// process may map it anywhere. The lower half of the buffers belongs to the
+// application for sending, the upper half to the stack for received data;
+// a buffer changes hands only through the rings, so neither side ever
+// locks. The stack creates the channel and the application opens it by name.
+class StackChannel {
+public:
+    static const uint32_t MAGIC = 0x5443484E; // "TCHN"
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_BUFFERS = 1u << 20;
+
+    StackChannel() : header(nullptr) {}
+
+    StackChannel(const StackChannel&) = delete;
+    StackChannel& operator=(const StackChannel&) = delete;
+
+    // Ring sizes are rounded up to powers of two.
+    bool create(const std::string& name, uint32_t request_slots = 1024, uint32_t completion_slots = 1024, uint32_t buffer_count = 2048, uint32_t buffer_size = 2048) {
+        request_slots = round_up_power_of_two(request_slots);
+        completion_slots = round_up_power_of_two(completion_slots);
+        if (buffer_count < 2 || buffer_count > MAX_BUFFERS || buffer_size == 0) {
+            return false;
+        }
+        buffer_size = (buffer_size + 63) & ~63u;
+        Layout layout = compute_layout(request_slots, completion_slots, buffer_count, buffer_size);
+        if (!region.create(name, layout.total)) {
+            return false;
+        }
+        header = new (region.data()) Header();
+        header->version = VERSION;
+        header->request_slots = request_slots;
+        header->completion_slots = completion_slots;
+        header->buffer_count = buffer_count;
+        header->buffer_size = buffer_size;
+        header->total_size = layout.total;
+        attach(name, layout);
+        header->magic.store(MAGIC, std::memory_order_release);
+        return true;
+    }
+
+    // Opens a channel created by the stack; false if there is none or it
+    // does not match this version.
+    bool open(const std::string& name) {
+        if (!region.open(name) || region.size() < sizeof(Header)) {
+            return false;
+        }
+        header = reinterpret_cast<Header*>(region.data());
+        if (header->magic.load(std::memory_order_acquire) != MAGIC || header->version != VERSION) {
+            header = nullptr;
+            region.close();
+            return false;
+        }
+        Layout layout = compute_layout(header->request_slots, header->completion_slots, header->buffer_count, header->buffer_size);
+        if (layout.total > region.size()) {
+            header = nullptr;
+            region.close();
+            return false;
+        }
+        attach(name, layout);
+        return true;
+    }
+
+    bool is_open() const {
+        return header != nullptr;
+    }
+
+    ChannelRing<ChannelRequest>& get_requests() {
+        return requests;
+    }
+
+    ChannelRing<ChannelCompletion>& get_completions() {
+        return completions;
+    }
+
+    // Rung by the application after posting requests
+    Doorbell& get_stack_doorbell() {
+        return stack_doorbell;
+    }
+
+    // Rung by the stack after posting completions
+    Doorbell& get_application_doorbell() {
+        return application_doorbell;
+    }
+
+    uint8_t* get_buffer(uint32_t index) {
+        return buffers + static_cast<size_t>(index) * header->buffer_size;
+    }
+
+    uint32_t get_buffer_count() const {
+        return header->buffer_count;
+    }
+
+    uint32_t get_buffer_size() const {
+        return header->buffer_size;
+    }
+
+    // Buffers below this index are the application's, the rest the stack's.
+    uint32_t get_first_receive_buffer() const {
+        return header->buffer_count / 2;
+    }
+
+private:
+    struct Header {
+        std::atomic<uint32_t> magic; // written last by the creator
+        uint32_t version;
+        uint32_t request_slots;
+        uint32_t completion_slots;
+        uint32_t buffer_count;
+        uint32_t buffer_size;
+        uint64_t total_size;
+        alignas(64) DoorbellState stack_doorbell;
+        alignas(64) DoorbellState application_doorbell;
+        RingControl requests;
+        RingControl completions;
+    };
+
+    struct Layout {
+        size_t requests;
+        size_t completions;
+        size_t buffers;
+        size_t total;
+    };
+
+    SharedRegion region;
+    Header* header;
+    ChannelRing<ChannelRequest> requests;
+    ChannelRing<ChannelCompletion> completions;
+    Doorbell stack_doorbell;
+    Doorbell application_doorbell;
+    uint8_t* buffers;
+
+    static uint32_t round_up_power_of_two(uint32_t value) {
+        uint32_t power = 1;
+        while (power < value && power < (1u << 30)) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+    static size_t align(size_t offset) {
+        return (offset + 63) & ~static_cast<size_t>(63);
+    }
+
+    static Layout compute_layout(uint32_t request_slots, uint32_t completion_slots, uint32_t buffer_count, uint32_t buffer_size) {
+        Layout layout;
+        layout.requests = align(sizeof(Header));
+        layout.completions = align(layout.requests + static_cast<size_t>(request_slots) * sizeof(ChannelRequest));
+        layout.buffers = align(layout.completions + static_cast<size_t>(completion_slots) * sizeof(ChannelCompletion));
+        layout.total = layout.buffers + static_cast<size_t>(buffer_count) * buffer_size;
+        return layout;
+    }
+
+    void attach(const std::string& name, const Layout& layout) {
+        uint8_t* base = region.data();
+        requests.attach(&header->requests, reinterpret_cast<ChannelRequest*>(base + layout.requests), header->request_slots);
+        completions.attach(&header->completions, reinterpret_cast<ChannelCompletion*>(base + layout.completions), header->completion_slots);
+        buffers = base + layout.buffers;
+        stack_doorbell.attach(&header->stack_doorbell, name + "-stack");
+        application_doorbell.attach(&header->application_doorbell, name + "-application");
+    }
+};
+
+#endif // STACKCHANNEL_H
@@ -0,0 +1,155 @@
+#ifndef STACKCLIENT_H
+#define STACKCLIENT_H
+
+#include "StackChannel.h"
+#include "Socket.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Application side of a StackChannel: sockets served by a stack running in
+// another process. Every call only writes a request into shared memory and
+// returns; results come back as completions from poll(). Handles are chosen
+// here, so a socket can be used right after open() without waiting for the
+// stack. A call returns false when the request ring is full (poll and
+// retry) or, for sends, when every send buffer is in flight.
+//
+// Sending copies into a shared buffer, or the application fills one from
+// get_send_buffer() itself; the buffer comes back with the CHANNEL_SEND
+// completion (UDP once transmitted, TCP once acknowledged). Received data
+// arrives in the stack's buffers: read it through get_data() and hand the
+// buffer back with release().
+class StackClient {
+public:
+    StackClient() : next_handle(1) {}
+
+    StackClient(const StackClient&) = delete;
+    StackClient& operator=(const StackClient&) = delete;
+
+    // Opens the channel the stack created under `name`.
+    bool attach(const std::string& name) {
+        if (!channel.open(name)) {
+            return false;
+        }
+        free_buffers.clear();
+        for (uint32_t index = channel.get_first_receive_buffer(); index > 0; index--) {
+            free_buffers.push_back(index - 1);
+        }
+        return true;
+    }
+
+    // Returns the new socket's handle, or 0 when the request ring is full.
+    uint32_t open(SocketType type) {
+        uint32_t handle = next_handle;
+        if (!post(CHANNEL_OPEN, handle, static_cast<uint8_t>(type))) {
+            return 0;
+        }
+        next_handle++;
+        return handle;
+    }
+
+    // Port 0 binds an ephemeral port; the completion's result is the port.
+    bool bind(uint32_t handle, uint16_t port) {
+        return post(CHANNEL_BIND, handle, 0, 0, port);
+    }
+
+    // Each accepted connection arrives as a CHANNEL_ACCEPTED completion.
+    bool listen(uint32_t handle, uint16_t port, uint32_t backlog = 128) {
+        return post(CHANNEL_LISTEN, handle, 0, 0, port, 0, backlog);
+    }
+
+    // TCP: opens the connection. UDP: sets the destination for sends without one.
+    bool connect(uint32_t handle, uint32_t ip, uint16_t port) {
+        return post(CHANNEL_CONNECT, handle, 0, ip, port);
+    }
+
+    // A free send buffer of get_buffer_size() bytes, or nullptr.
+    uint8_t* get_send_buffer(uint32_t& index) {
+        if (free_buffers.empty()) {
+            return nullptr;
+        }
+        index = free_buffers.back();
+        free_buffers.pop_back();
+        return channel.get_buffer(index);
+    }
+
+    // Sends the first `length` bytes of a buffer from get_send_buffer(). UDP
+    // goes to (ip, port), or the connect() address when ip is 0.
+    bool send_buffer(uint32_t handle, uint32_t index, size_t length, uint32_t ip = 0, uint16_t port = 0) {
+        if (length > channel.get_buffer_size()) {
+            return false;
+        }
+        return post(CHANNEL_SEND, handle, 0, ip, port, index, static_cast<uint32_t>(length));
+    }
+
+    bool send(uint32_t handle, const uint8_t* data, size_t length, uint32_t ip = 0, uint16_t port = 0) {
+        if (length > channel.get_buffer_size() || free_buffers.empty() || channel.get_requests().free_slots() == 0) {
+            return false;
+        }
+        uint32_t index;
+        memcpy(get_send_buffer(index), data, length);
+        return send_buffer(handle, index, length, ip, port);
+    }
+
+    // Returns a buffer from a CHANNEL_RECEIVED completion to the stack.
+    bool release(uint32_t buffer) {
+        return post(CHANNEL_RELEASE, 0, 0, 0, 0, buffer);
+    }
+
+    bool close(uint32_t handle) {
+        return post(CHANNEL_CLOSE, handle);
+    }
+
+    // Moves up to `max_completions` completions to `out`; returns the count.
+    // Send buffers in CHANNEL_SEND completions are free again on return.
+    size_t poll(std::vector<ChannelCompletion>& out, size_t max_completions = 64) {
+        ChannelRing<ChannelCompletion>& completions = channel.get_completions();
+        size_t count = 0;
+        ChannelCompletion completion;
+        while (count < max_completions && completions.pop(completion)) {
+            if (completion.op == CHANNEL_SEND && completion.buffer < channel.get_first_receive_buffer()) {
+                free_buffers.push_back(completion.buffer);
+            }
+            out.push_back(completion);
+            count++;
+        }
+        return count;
+    }
+
+    // Sleeps until the stack posts a completion or `timeout_ms` passes.
+    void wait(uint32_t timeout_ms) {
+        ChannelRing<ChannelCompletion>& completions = channel.get_completions();
+        channel.get_application_doorbell().wait([&completions] { return !completions.empty(); }, timeout_ms);
+    }
+
+    // Payload of a CHANNEL_RECEIVED completion
+    const uint8_t* get_data(const ChannelCompletion& completion) {
+        return channel.get_buffer(completion.buffer);
+    }
+
+    uint32_t get_buffer_size() const {
+        return channel.get_buffer_size();
+    }
+
+    size_t free_send_buffers() const {
+        return free_buffers.size();
+    }
+
+private:
+    StackChannel channel;
+    std::vector<uint32_t> free_buffers; // send buffers owned by this side
+    uint32_t next_handle; // the stack numbers accepted connections from 0x80000000
+
+    bool post(uint8_t op, uint32_t handle, uint8_t type = 0, uint32_t ip = 0, uint16_t port = 0, uint32_t buffer = 0, uint32_t length = 0) {
+        ChannelRequest request = { op, type, port, handle, ip, buffer, length, 0 };
+        if (!channel.get_requests().push(request)) {
+            return false;
+        }
+        channel.get_stack_doorbell().notify();
+        return true;
+    }
+};
+
+#endif // STACKCLIENT_H
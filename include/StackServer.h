@@ -0,0 +1,504 @@
+#ifndef STACKSERVER_H
+#define STACKSERVER_H
+
+#include "StackChannel.h"
+#include "Socket.h"
+#include "UDPLayer.h"
+#include "TCPConnection.h"
+#include "TCPListener.h"
+#include "ConnectionTable.h"
+#include "CompletionQueue.h"
+#include "EventPoller.h"
+#include "TimerWheel.h"
+#include "Link.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Stack side of the shared-memory transport: serves the sockets of several
+// application processes, one StackChannel each, over this process's
+// UDPLayer and TCP connection table. poll() executes queued requests,
+// copies newly received data into the stack's half of each channel's
+// buffers, and posts completions. Sends never copy: UDP datagrams are built
+// from the application's buffer and TCP sends reference it as zero-copy
+// sends until acknowledged.
+//
+// Like the EventLoop, the server never blocks; whoever drives the stack
+// (link receive, timers; see Stack) calls poll() after each round.
+// Applications are untrusted: requests naming unknown handles or buffers
+// fail rather than touch memory they do not own.
+class StackServer {
+public:
+    // Handles the stack assigns to accepted connections start here
+    static const uint32_t ACCEPTED_HANDLE_BASE = 0x80000000;
+
+    StackServer(Link& link, UDPLayer& udp, TCPListener::Table& table, TimerWheel* timers = nullptr)
+        : link(link),
+        udp(udp),
+        table(table),
+        timer_wheel(timers),
+        local_ip(udp.get_local_ip()),
+        next_port(UDPLayer::EPHEMERAL_PORT_MIN),
+        requests_handled(0),
+        completions_posted(0),
+        bytes_received(0) {}
+
+    ~StackServer() {
+        for (auto& application : applications) {
+            for (auto& entry : application->handles) {
+                release(*entry.second);
+            }
+        }
+    }
+
+    StackServer(const StackServer&) = delete;
+    StackServer& operator=(const StackServer&) = delete;
+
+    // Creates the channel an application opens by `name`.
+    bool add_application(const std::string& name, uint32_t request_slots = 1024, uint32_t completion_slots = 1024, uint32_t buffer_count = 2048, uint32_t buffer_size = 2048) {
+        std::unique_ptr<Application> application(new Application());
+        if (!application->channel.create(name, request_slots, completion_slots, buffer_count, buffer_size)) {
+            return false;
+        }
+        application->index = static_cast<uint32_t>(applications.size());
+        StackChannel& channel = application->channel;
+        for (uint32_t index = channel.get_buffer_count(); index > channel.get_first_receive_buffer(); index--) {
+            application->free_buffers.push_back(index - 1);
+        }
+        application->lent.assign(channel.get_buffer_count() - channel.get_first_receive_buffer(), false);
+        application->senders.assign(channel.get_first_receive_buffer(), 0);
+        applications.push_back(std::move(application));
+        return true;
+    }
+
+    // Serves every application once; returns the requests and socket events handled.
+    size_t poll(size_t max_requests = 256) {
+        size_t work = 0;
+        for (auto& application : applications) {
+            flush_backlog(*application);
+            work += handle_requests(*application, max_requests);
+        }
+        work += handle_sent();
+        poller.wait(events, 256);
+        for (const auto& event : events) {
+            Handle& handle = *static_cast<Handle*>(event.user_data);
+            if (handle.listener) {
+                handle_accept(handle);
+            }
+            else if (handle.connection) {
+                handle_connection(handle, event.events);
+            }
+            else {
+                handle_datagrams(handle);
+            }
+        }
+        work += events.size();
+        events.clear();
+        reap_closing();
+        for (auto& application : applications) {
+            if (application->notify) {
+                application->notify = false;
+                application->channel.get_application_doorbell().notify();
+            }
+        }
+        return work;
+    }
+
+    size_t application_count() const {
+        return applications.size();
+    }
+
+    uint64_t get_requests_handled() const {
+        return requests_handled;
+    }
+
+    uint64_t get_completions_posted() const {
+        return completions_posted;
+    }
+
+    uint64_t get_bytes_received() const {
+        return bytes_received;
+    }
+
+private:
+    struct Application;
+
+    // One socket of an application
+    struct Handle {
+        Application* application;
+        uint32_t id;
+        SocketType type;
+        uint16_t port = 0;        // bound local port
+        uint32_t remote_ip = 0;   // UDP: connect() destination
+        uint16_t remote_port = 0;
+        bool connecting = false;
+        EventPoller::Source readiness; // UDP endpoint
+        std::unique_ptr<TCPConnection> connection;
+        std::unique_ptr<TCPListener> listener;
+    };
+
+    struct Application {
+        StackChannel channel;
+        uint32_t index = 0;
+        std::unordered_map<uint32_t, std::unique_ptr<Handle>> handles;
+        std::vector<uint32_t> free_buffers; // receive buffers held by the stack
+        std::vector<bool> lent;             // receive buffers held by the application
+        std::vector<uint32_t> senders;      // handle of each send buffer in flight
+        std::deque<ChannelCompletion> backlog; // completions waiting for ring space
+        uint32_t next_accepted = ACCEPTED_HANDLE_BASE;
+        bool notify = false;
+    };
+
+    static constexpr size_t MAX_BACKLOG = 4096; // stop taking requests beyond this
+    static constexpr size_t MAX_DATAGRAMS = 64; // per socket and round
+
+    Link& link;
+    UDPLayer& udp;
+    TCPListener::Table& table;
+    TimerWheel* timer_wheel;
+    uint32_t local_ip;
+    uint16_t next_port;
+    CompletionQueue sent; // before the connections, which report to it
+    EventPoller poller;
+    std::vector<EventPoller::Event> events;
+    std::vector<UDPDatagram> datagrams;
+    std::vector<SendCompletion> sent_completions;
+    std::vector<std::unique_ptr<TCPConnection>> closing;
+    std::vector<std::unique_ptr<Application>> applications;
+    uint64_t requests_handled;
+    uint64_t completions_posted;
+    uint64_t bytes_received;
+
+    void complete(Application& application, uint8_t op, uint32_t handle, int32_t result, uint32_t buffer = 0, uint32_t length = 0, uint32_t ip = 0, uint16_t port = 0) {
+        ChannelCompletion completion = { op, 0, port, handle, ip, buffer, length, result };
+        if (!application.backlog.empty() || !application.channel.get_completions().push(completion)) {
+            application.backlog.push_back(completion);
+        }
+        application.notify = true;
+        completions_posted++;
+    }
+
+    void flush_backlog(Application& application) {
+        ChannelRing<ChannelCompletion>& completions = application.channel.get_completions();
+        while (!application.backlog.empty() && completions.push(application.backlog.front())) {
+            application.backlog.pop_front();
+            application.notify = true;
+        }
+    }
+
+    size_t handle_requests(Application& application, size_t max_requests) {
+        ChannelRing<ChannelRequest>& requests = application.channel.get_requests();
+        size_t count = 0;
+        ChannelRequest request;
+        while (count < max_requests && application.backlog.size() < MAX_BACKLOG && requests.pop(request)) {
+            handle_request(application, request);
+            count++;
+        }
+        requests_handled += count;
+        return count;
+    }
+
+    void handle_request(Application& application, const ChannelRequest& request) {
+        if (request.op == CHANNEL_OPEN) {
+            open(application, request);
+            return;
+        }
+        if (request.op == CHANNEL_RELEASE) {
+            uint32_t first = application.channel.get_first_receive_buffer();
+            if (request.buffer >= first && request.buffer < application.channel.get_buffer_count() && application.lent[request.buffer - first]) {
+                application.lent[request.buffer - first] = false;
+                application.free_buffers.push_back(request.buffer);
+            }
+            return;
+        }
+        auto it = application.handles.find(request.handle);
+        if (it == application.handles.end()) {
+            complete(application, request.op, request.handle, -1, request.buffer);
+            return;
+        }
+        Handle& handle = *it->second;
+        switch (request.op) {
+        case CHANNEL_BIND:
+            complete(application, CHANNEL_BIND, handle.id, bind(handle, request.port) ? handle.port : -1);
+            break;
+        case CHANNEL_LISTEN:
+            complete(application, CHANNEL_LISTEN, handle.id, listen(handle, request.port, request.length) ? 0 : -1);
+            break;
+        case CHANNEL_CONNECT:
+            if (!connect(handle, request.ip, request.port)) {
+                complete(application, CHANNEL_CONNECT, handle.id, -1);
+            }
+            else if (handle.type == SOCKET_TYPE_UDP) {
+                complete(application, CHANNEL_CONNECT, handle.id, 0);
+            }
+            break;
+        case CHANNEL_SEND:
+            send(handle, request);
+            break;
+        case CHANNEL_CLOSE:
+            release(handle);
+            application.handles.erase(it);
+            complete(application, CHANNEL_CLOSE, request.handle, 0);
+            break;
+        default:
+            complete(application, request.op, request.handle, -1);
+            break;
+        }
+    }
+
+    void open(Application& application, const ChannelRequest& request) {
+        bool valid = request.handle != 0 && request.handle < ACCEPTED_HANDLE_BASE && application.handles.count(request.handle) == 0
+            && (request.type == SOCKET_TYPE_UDP || request.type == SOCKET_TYPE_TCP);
+        if (valid) {
+            create_handle(application, request.handle, static_cast<SocketType>(request.type));
+        }
+        complete(application, CHANNEL_OPEN, request.handle, valid ? 0 : -1);
+    }
+
+    Handle& create_handle(Application& application, uint32_t id, SocketType type) {
+        std::unique_ptr<Handle> handle(new Handle());
+        handle->application = &application;
+        handle->id = id;
+        handle->type = type;
+        Handle& result = *handle;
+        application.handles[id] = std::move(handle);
+        return result;
+    }
+
+    bool bind(Handle& handle, uint16_t port) {
+        if (handle.port != 0 || handle.connection || handle.listener) {
+            return false;
+        }
+        if (handle.type == SOCKET_TYPE_TCP) {
+            handle.port = port != 0 ? port : find_tcp_port(0, 0);
+            return handle.port != 0;
+        }
+        handle.port = udp.bind(port);
+        if (handle.port == 0) {
+            return false;
+        }
+        udp.set_poll_source(handle.port, &handle.readiness);
+        poller.add(handle.readiness, EventPoller::READABLE, &handle);
+        return true;
+    }
+
+    bool listen(Handle& handle, uint16_t port, uint32_t backlog) {
+        if (handle.type != SOCKET_TYPE_TCP || handle.connection || handle.listener || (port == 0 && handle.port == 0)) {
+            return false;
+        }
+        if (port == 0) {
+            port = handle.port;
+        }
+        if (table.find_listener(local_ip, port)) {
+            return false;
+        }
+        handle.port = port;
+        handle.listener.reset(new TCPListener(local_ip, port, link, timer_wheel, backlog != 0 ? backlog : 128));
+        handle.listener->set_connection_table(&table);
+        table.add_listener(local_ip, port, handle.listener.get());
+        poller.add(handle.listener->get_poll_source(), EventPoller::ACCEPTABLE, &handle);
+        return true;
+    }
+
+    bool connect(Handle& handle, uint32_t ip, uint16_t port) {
+        if (handle.type == SOCKET_TYPE_UDP) {
+            if (handle.port == 0 && !bind(handle, 0)) {
+                return false;
+            }
+            handle.remote_ip = ip;
+            handle.remote_port = port;
+            return true;
+        }
+        if (handle.connection || handle.listener || port == 0) {
+            return false;
+        }
+        uint16_t local_port = handle.port != 0 ? handle.port : find_tcp_port(ip, port);
+        if (local_port == 0 || table.find_connection(ip, port, local_ip, local_port)) {
+            return false;
+        }
+        handle.port = local_port;
+        handle.connection.reset(new TCPConnection(local_port, port, local_ip, ip, timer_wheel));
+        attach_connection(handle);
+        handle.connection->add_to_table(table);
+        handle.connecting = true;
+        poller.modify(handle.connection->get_poll_source(), EventPoller::READABLE | EventPoller::WRITABLE, &handle);
+        handle.connection->send_syn();
+        return true;
+    }
+
+    void attach_connection(Handle& handle) {
+        handle.connection->set_link(&link);
+        handle.connection->set_completion_queue(&sent);
+        poller.add(handle.connection->get_poll_source(), EventPoller::READABLE, &handle);
+    }
+
+    void send(Handle& handle, const ChannelRequest& request) {
+        Application& application = *handle.application;
+        StackChannel& channel = application.channel;
+        if (request.buffer >= channel.get_first_receive_buffer() || request.length > channel.get_buffer_size()) {
+            complete(application, CHANNEL_SEND, handle.id, -1, request.buffer);
+            return;
+        }
+        const uint8_t* data = channel.get_buffer(request.buffer);
+        if (handle.type == SOCKET_TYPE_UDP) {
+            uint32_t ip = request.ip != 0 ? request.ip : handle.remote_ip;
+            uint16_t port = request.ip != 0 ? request.port : handle.remote_port;
+            bool sent_ok = ip != 0 && (handle.port != 0 || bind(handle, 0)) && udp.send(handle.port, ip, port, data, request.length);
+            complete(application, CHANNEL_SEND, handle.id, sent_ok ? 0 : -1, request.buffer);
+            return;
+        }
+        uint64_t id = (static_cast<uint64_t>(application.index) << 32) | request.buffer;
+        if (!handle.connection || !(handle.connection->poll_events() & EventPoller::WRITABLE) || !handle.connection->send_zerocopy(data, request.length, id)) {
+            complete(application, CHANNEL_SEND, handle.id, -1, request.buffer);
+            return;
+        }
+        application.senders[request.buffer] = handle.id;
+    }
+
+    // TCP sends the peer acknowledged, or dropped with their connection
+    size_t handle_sent() {
+        sent_completions.clear();
+        size_t count = sent.poll(sent_completions, sent.size());
+        for (const auto& completion : sent_completions) {
+            uint32_t index = static_cast<uint32_t>(completion.id >> 32);
+            if (index >= applications.size()) {
+                continue;
+            }
+            Application& application = *applications[index];
+            uint32_t buffer = static_cast<uint32_t>(completion.id);
+            complete(application, CHANNEL_SEND, application.senders[buffer], completion.delivered ? 0 : -1, buffer);
+        }
+        return count;
+    }
+
+    void handle_accept(Handle& handle) {
+        Application& application = *handle.application;
+        while (std::unique_ptr<TCPConnection> connection = handle.listener->accept()) {
+            Handle& accepted = create_handle(application, application.next_accepted++, SOCKET_TYPE_TCP);
+            accepted.port = handle.port;
+            accepted.connection = std::move(connection);
+            attach_connection(accepted);
+            complete(application, CHANNEL_ACCEPTED, accepted.id, static_cast<int32_t>(handle.id), 0, 0,
+                accepted.connection->get_dest_ip(), accepted.connection->get_dest_port());
+        }
+    }
+
+    void handle_connection(Handle& handle, uint32_t events) {
+        Application& application = *handle.application;
+        TCPConnection& connection = *handle.connection;
+        const uint32_t failed = EventPoller::FAILURE | EventPoller::HANGUP;
+        if (handle.connecting && (events & (EventPoller::WRITABLE | failed))) {
+            handle.connecting = false;
+            bool established = connection.get_state() == TCPConnection::ESTABLISHED;
+            complete(application, CHANNEL_CONNECT, handle.id, established ? 0 : -1);
+            poller.modify(connection.get_poll_source(), EventPoller::READABLE, &handle);
+            if (!established) {
+                poller.remove(connection.get_poll_source());
+                return;
+            }
+        }
+        ChannelRing<ChannelCompletion>& completions = application.channel.get_completions();
+        uint32_t size = application.channel.get_buffer_size();
+        size_t length = 1;
+        while ((events & EventPoller::READABLE) && !application.free_buffers.empty() && application.backlog.empty() && completions.free_slots() > 0) {
+            uint32_t buffer = application.free_buffers.back();
+            length = connection.receive(application.channel.get_buffer(buffer), size);
+            if (length == 0) {
+                break;
+            }
+            application.free_buffers.pop_back();
+            lend(application, buffer);
+            complete(application, CHANNEL_RECEIVED, handle.id, static_cast<int32_t>(length), buffer, static_cast<uint32_t>(length),
+                connection.get_dest_ip(), connection.get_dest_port());
+            bytes_received += length;
+        }
+        // Readable with nothing left to read is the peer's FIN; report it, or a failure, once
+        uint32_t current = connection.poll_events();
+        bool end_of_stream = (length == 0 && (current & EventPoller::READABLE)) || ((events & failed) && !(current & EventPoller::READABLE));
+        if (end_of_stream) {
+            complete(application, CHANNEL_HANGUP, handle.id, (events & EventPoller::FAILURE) ? -1 : 0);
+            poller.remove(connection.get_poll_source());
+        }
+    }
+
+    void handle_datagrams(Handle& handle) {
+        Application& application = *handle.application;
+        size_t room = std::min<size_t>({ application.free_buffers.size(), application.channel.get_completions().free_slots(), MAX_DATAGRAMS });
+        if (room == 0 || !application.backlog.empty()) {
+            return; // stays readable; retried next round
+        }
+        datagrams.clear();
+        udp.receive(handle.port, datagrams, room);
+        uint32_t size = application.channel.get_buffer_size();
+        for (const auto& datagram : datagrams) {
+            uint32_t buffer = application.free_buffers.back();
+            application.free_buffers.pop_back();
+            uint32_t length = static_cast<uint32_t>(std::min<size_t>(datagram.data.size(), size));
+            memcpy(application.channel.get_buffer(buffer), datagram.data.data(), length);
+            lend(application, buffer);
+            complete(application, CHANNEL_RECEIVED, handle.id, static_cast<int32_t>(datagram.data.size()), buffer, length, datagram.ip, datagram.port);
+            bytes_received += length;
+        }
+    }
+
+    void lend(Application& application, uint32_t buffer) {
+        application.lent[buffer - application.channel.get_first_receive_buffer()] = true;
+    }
+
+    // Drops the handle's socket. A TCP connection is closed gracefully and
+    // kept until the close completes.
+    void release(Handle& handle) {
+        if (handle.listener) {
+            table.remove_listener(local_ip, handle.port);
+            handle.listener.reset();
+        }
+        else if (handle.connection) {
+            poller.remove(handle.connection->get_poll_source());
+            handle.connection->send_fin();
+            closing.push_back(std::move(handle.connection));
+        }
+        else if (handle.type == SOCKET_TYPE_UDP && handle.port != 0) {
+            udp.unbind(handle.port);
+        }
+    }
+
+    // Connections closed by the application are freed once the close is
+    // done; without timers TIME_WAIT never ends, so it counts as done.
+    void reap_closing() {
+        for (size_t i = 0; i < closing.size(); ) {
+            TCPConnection::State state = closing[i]->get_state();
+            bool done = state == TCPConnection::CLOSED || state == TCPConnection::SYN_SENT
+                || (!timer_wheel && state == TCPConnection::TIME_WAIT);
+            if (done) {
+                closing[i] = std::move(closing.back());
+                closing.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    // A free ephemeral port towards (ip, port); 0 if there is none.
+    uint16_t find_tcp_port(uint32_t ip, uint16_t port) {
+        for (uint32_t tries = 0; tries <= UDPLayer::EPHEMERAL_PORT_MAX - UDPLayer::EPHEMERAL_PORT_MIN; tries++) {
+            uint16_t candidate = next_port;
+            next_port++;
+            if (next_port < UDPLayer::EPHEMERAL_PORT_MIN) {
+                next_port = UDPLayer::EPHEMERAL_PORT_MIN; // wrapped past 65535
+            }
+            if (!table.find_connection(ip, port, local_ip, candidate) && !table.find_listener(local_ip, candidate)) {
+                return candidate;
+            }
+        }
+        return 0;
+    }
+};
+
+#endif // STACKSERVER_H
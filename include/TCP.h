@@ -4,6 +4,200 @@
 #include <vector>
 #include <cstdint>
 #include <cstring>
+#include "Checksum.h"
+
+// TCP options (RFC 9293 3.1): MSS, window scale and timestamps (RFC 7323),
+// SACK-permitted and SACK blocks (RFC 2018), Fast Open cookies (RFC 7413).
+// Absent options are zero / false.
+struct TCPOptions {
+    enum Kind {
+        END = 0,
+        NOP = 1,
+        MSS = 2,
+        WINDOW_SCALE = 3,
+        SACK_PERMITTED = 4,
+        SACK = 5,
+        TIMESTAMP = 8,
+        FAST_OPEN = 34
+    };
+
+    static const size_t MAX_LENGTH = 40;
+    static const uint8_t MAX_SACK_BLOCKS = 4;
+    static const uint8_t MAX_WINDOW_SCALE = 14;
+    static const uint8_t MIN_FAST_OPEN_COOKIE = 4;
+    static const uint8_t MAX_FAST_OPEN_COOKIE = 16;
+
+    struct SackBlock {
+        uint32_t left;  // first sequence number of the block
+        uint32_t right; // sequence number following the block
+    };
+
+    uint16_t mss = 0;
+    bool has_window_scale = false;
+    uint8_t window_scale = 0;
+    bool sack_permitted = false;
+    bool has_timestamp = false;
+    uint32_t ts_val = 0;
+    uint32_t ts_ecr = 0;
+    uint8_t sack_count = 0;
+    SackBlock sack_blocks[MAX_SACK_BLOCKS];
+    bool fast_open = false; // a Fast Open option is present
+    uint8_t fast_open_cookie_length = 0; // 0 in a cookie request
+    uint8_t fast_open_cookie[MAX_FAST_OPEN_COOKIE];
+
+    // Blocks that fit next to the other options in the 40 option bytes
+    uint8_t max_sack_blocks() const {
+        return has_timestamp ? 3 : MAX_SACK_BLOCKS;
+    }
+
+    // Encoded size, a multiple of 4
+    size_t length() const {
+        uint8_t buffer[MAX_LENGTH];
+        return encode(buffer);
+    }
+
+    // Writes the options in the usual order, NOP-padded to 32-bit alignment.
+    size_t encode(uint8_t* out) const {
+        size_t n = 0;
+        if (mss != 0) {
+            out[n++] = MSS;
+            out[n++] = 4;
+            put16(out + n, mss);
+            n += 2;
+        }
+        if (has_timestamp) {
+            if (sack_permitted) {
+                out[n++] = SACK_PERMITTED;
+                out[n++] = 2;
+            }
+            else {
+                out[n++] = NOP;
+                out[n++] = NOP;
+            }
+            out[n++] = TIMESTAMP;
+            out[n++] = 10;
+            put32(out + n, ts_val);
+            put32(out + n + 4, ts_ecr);
+            n += 8;
+        }
+        if (has_window_scale) {
+            out[n++] = NOP;
+            out[n++] = WINDOW_SCALE;
+            out[n++] = 3;
+            out[n++] = window_scale;
+        }
+        if (sack_permitted && !has_timestamp) {
+            out[n++] = NOP;
+            out[n++] = NOP;
+            out[n++] = SACK_PERMITTED;
+            out[n++] = 2;
+        }
+        if (fast_open) {
+            for (size_t pad = (2 + fast_open_cookie_length) % 4; pad != 0 && pad < 4; pad++) {
+                out[n++] = NOP;
+            }
+            out[n++] = FAST_OPEN;
+            out[n++] = static_cast<uint8_t>(2 + fast_open_cookie_length);
+            memcpy(out + n, fast_open_cookie, fast_open_cookie_length);
+            n += fast_open_cookie_length;
+        }
+        size_t room = n + 4 < MAX_LENGTH ? (MAX_LENGTH - n - 4) / 8 : 0;
+        uint8_t blocks = static_cast<uint8_t>(sack_count < room ? sack_count : room);
+        if (blocks > 0) {
+            out[n++] = NOP;
+            out[n++] = NOP;
+            out[n++] = SACK;
+            out[n++] = static_cast<uint8_t>(2 + 8 * blocks);
+            for (uint8_t i = 0; i < blocks; i++) {
+                put32(out + n, sack_blocks[i].left);
+                put32(out + n + 4, sack_blocks[i].right);
+                n += 8;
+            }
+        }
+        return n;
+    }
+
+    // Parses the option bytes of a header; stops at a malformed option.
+    static TCPOptions parse(const uint8_t* data, size_t length) {
+        TCPOptions options;
+        size_t i = 0;
+        while (i < length) {
+            uint8_t kind = data[i];
+            if (kind == END) {
+                break;
+            }
+            if (kind == NOP) {
+                i++;
+                continue;
+            }
+            if (i + 1 >= length || data[i + 1] < 2 || i + data[i + 1] > length) {
+                break;
+            }
+            uint8_t size = data[i + 1];
+            const uint8_t* value = data + i + 2;
+            switch (kind) {
+            case MSS:
+                if (size == 4) {
+                    options.mss = get16(value);
+                }
+                break;
+            case WINDOW_SCALE:
+                if (size == 3) {
+                    options.has_window_scale = true;
+                    options.window_scale = value[0] < MAX_WINDOW_SCALE ? value[0] : MAX_WINDOW_SCALE;
+                }
+                break;
+            case SACK_PERMITTED:
+                options.sack_permitted = (size == 2);
+                break;
+            case TIMESTAMP:
+                if (size == 10) {
+                    options.has_timestamp = true;
+                    options.ts_val = get32(value);
+                    options.ts_ecr = get32(value + 4);
+                }
+                break;
+            case SACK:
+                for (size_t offset = 0; offset + 8 <= size_t(size - 2) && options.sack_count < MAX_SACK_BLOCKS; offset += 8) {
+                    options.sack_blocks[options.sack_count].left = get32(value + offset);
+                    options.sack_blocks[options.sack_count].right = get32(value + offset + 4);
+                    options.sack_count++;
+                }
+                break;
+            case FAST_OPEN:
+                if (size == 2 || (size - 2 >= MIN_FAST_OPEN_COOKIE && size - 2 <= MAX_FAST_OPEN_COOKIE && size % 2 == 0)) {
+                    options.fast_open = true;
+                    options.fast_open_cookie_length = static_cast<uint8_t>(size - 2);
+                    memcpy(options.fast_open_cookie, value, size - 2);
+                }
+                break;
+            }
+            i += size;
+        }
+        return options;
+    }
+
+private:
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = v >> 8;
+        p[1] = v & 0xFF;
+    }
+
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = (v >> 16) & 0xFF;
+        p[2] = (v >> 8) & 0xFF;
+        p[3] = v & 0xFF;
+    }
+
+    static uint16_t get16(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+};
 
 class TCPSegment {
 public:
@@ -16,6 +210,7 @@ public:
     uint16_t window_size;
     uint16_t checksum;
     uint16_t urgent_pointer;
+    TCPOptions options;
     std::vector<uint8_t> payload;
 
     enum Flag {
@@ -39,25 +234,58 @@ public:
         window_size(htons(8192)),
         checksum(0),
         urgent_pointer(0),
-        payload(p) {
-        checksum = calculate_checksum();
+        payload(p) {}
+
+    // Header size including options
+    size_t header_length() const {
+        return 20 + options.length();
     }
 
     std::vector<uint8_t> serialize() const {
-        std::vector<uint8_t> buffer(20 + payload.size());
+        uint8_t option_bytes[TCPOptions::MAX_LENGTH];
+        size_t options_length = options.encode(option_bytes);
+        size_t header_length = 20 + options_length;
+        std::vector<uint8_t> buffer(header_length + payload.size());
         memcpy(buffer.data(), &src_port, 2);
         memcpy(buffer.data() + 2, &dest_port, 2);
         memcpy(buffer.data() + 4, &seq_num, 4);
         memcpy(buffer.data() + 8, &ack_num, 4);
-        buffer[12] = data_offset_res_flags;
+        buffer[12] = static_cast<uint8_t>(((header_length / 4) << 4) | (data_offset_res_flags & 0x0F));
         buffer[13] = flags;
         memcpy(buffer.data() + 14, &window_size, 2);
         memcpy(buffer.data() + 16, &checksum, 2);
         memcpy(buffer.data() + 18, &urgent_pointer, 2);
-        memcpy(buffer.data() + 20, payload.data(), payload.size());
+        memcpy(buffer.data() + 20, option_bytes, options_length);
+        memcpy(buffer.data() + header_length, payload.data(), payload.size());
         return buffer;
     }
 
+    // Serializes with the checksum over the pseudo-header (RFC 9293 3.1);
+    // addresses are those passed to the IPPacket constructor (on receive,
+    // IPPacket::src and IPPacket::dest of the deserialized packet).
+    std::vector<uint8_t> serialize(uint32_t src_ip, uint32_t dest_ip) const {
+        std::vector<uint8_t> buffer = serialize();
+        buffer[16] = 0;
+        buffer[17] = 0;
+        uint16_t sum = compute_checksum(buffer.data(), buffer.size(), src_ip, dest_ip);
+        buffer[16] = sum >> 8;
+        buffer[17] = sum & 0xFF;
+        return buffer;
+    }
+
+    // Checksum of a serialized segment whose checksum field is zero; a
+    // segment with a correct checksum in place yields 0.
+    static uint16_t compute_checksum(const uint8_t* data, size_t length, uint32_t src_ip, uint32_t dest_ip) {
+        uint32_t src = htonl(src_ip);
+        uint32_t dest = htonl(dest_ip);
+        uint32_t sum = Checksum::pseudo_header(reinterpret_cast<const uint8_t*>(&src), reinterpret_cast<const uint8_t*>(&dest), IPPROTO_TCP, static_cast<uint16_t>(length));
+        return Checksum::fold(Checksum::add(data, length, sum));
+    }
+
+    static bool verify_checksum(const std::vector<uint8_t>& data, uint32_t src_ip, uint32_t dest_ip) {
+        return compute_checksum(data.data(), data.size(), src_ip, dest_ip) == 0;
+    }
+
     static TCPSegment deserialize(const std::vector<uint8_t>& data) {
         uint16_t src_port = (data[0] << 8) | data[1];
         uint16_t dest_port = (data[2] << 8) | data[3];
@@ -68,13 +296,23 @@ public:
         uint16_t window_size = (data[14] << 8) | data[15];
         uint16_t checksum = (data[16] << 8) | data[17];
         uint16_t urgent_pointer = (data[18] << 8) | data[19];
-        std::vector<uint8_t> payload(data.begin() + 20, data.end());
+        size_t header_length = (data_offset_res_flags >> 4) * 4;
+        if (header_length < 20 || header_length > data.size()) {
+            header_length = 20;
+        }
+        std::vector<uint8_t> payload(data.begin() + header_length, data.end());
 
-        return TCPSegment(ntohs(src_port), ntohs(dest_port), ntohl(seq_num), ntohl(ack_num), payload, flags);
+        TCPSegment segment(src_port, dest_port, seq_num, ack_num, payload, flags);
+        segment.window_size = htons(window_size);
+        segment.checksum = htons(checksum);
+        segment.urgent_pointer = htons(urgent_pointer);
+        segment.options = TCPOptions::parse(data.data() + 20, header_length - 20);
+        return segment;
     }
 
-    static std::vector<uint8_t> create_tcp_header(uint16_t src_port, uint16_t dest_port, uint32_t seq_num, uint32_t ack_num, uint8_t flags, uint16_t window_size) {
-        std::vector<uint8_t> header(20, 0); // TCP header is 20 bytes
+    static std::vector<uint8_t> create_tcp_header(uint16_t src_port, uint16_t dest_port, uint32_t seq_num, uint32_t ack_num, uint8_t flags, uint16_t window_size, const TCPOptions& options = TCPOptions()) {
+        std::vector<uint8_t> header(20 + TCPOptions::MAX_LENGTH, 0); // 20 bytes plus options
+        header.resize(20 + options.encode(header.data() + 20));
 
         header[0] = src_port >> 8;
         header[1] = src_port & 0xFF;
@@ -88,7 +326,7 @@ public:
         header[9] = (ack_num >> 16) & 0xFF;
         header[10] = (ack_num >> 8) & 0xFF;
         header[11] = ack_num & 0xFF;
-        header[12] = (5 << 4); // Data offset (5 * 4 = 20 bytes)
+        header[12] = static_cast<uint8_t>((header.size() / 4) << 4); // Data offset in 32-bit words
         header[13] = flags;
         header[14] = window_size >> 8;
         header[15] = window_size & 0xFF;
@@ -101,25 +339,15 @@ public:
 
         return header;
     }
-private:
-    uint16_t calculate_checksum() const {
-        // Уͼ㣬ʾ
-        uint32_t sum = 0;
-        const uint16_t* header = reinterpret_cast<const uint16_t*>(this);
-        for (int i = 0; i < 10; ++i) {
-            sum += ntohs(header[i]);
-        }
-        for (size_t i = 0; i < payload.size(); i += 2) {
-            uint16_t word = payload[i] << 8;
-            if (i + 1 < payload.size()) {
-                word |= payload[i + 1];
-            }
-            sum += ntohs(word);
-        }
-        sum = (sum & 0xFFFF) + (sum >> 16);
-        sum += (sum >> 16);
-        return htons(~sum);
-    }
 };
 
+// Sequence number comparisons modulo 2^32 (RFC 793 section 3.3)
+inline bool seq_before(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+inline bool seq_after(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+}
+
 #endif // TCP_H
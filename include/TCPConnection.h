@@ -4,11 +4,22 @@
 #include "TCP.h"
 #include "IP.h"
 #include "Ethernet.h"
+#include "CongestionControl.h"
+#include "TimerWheel.h"
+#include "RTTEstimator.h"
+#include "Link.h"
+#include "SegmentationOffload.h"
+#include "ByteRing.h"
+#include "SendBuffer.h"
+#include "RetransmitQueue.h"
+#include "FastOpenCache.h"
+#include "EventPoller.h"
+#include "ConnectionTable.h"
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <thread>
 #include <map>
+#include <memory>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -21,9 +32,18 @@
 #include <unistd.h>
 #endif
 
-class TCPConnection {
+// Control block layout: the fields header prediction and ACK processing
+// touch sit in the first cache line (the class is 64-byte aligned), warm
+// transmit state follows, and rarely used state (out-of-order reassembly)
+// is allocated on demand. Send and receive buffers hold storage while they
+// hold data and for BUFFER_IDLE_TIMEOUT after draining, so an idle
+// established connection stays under 1 KB.
+
+class TCPListener;
+
+class alignas(64) TCPConnection {
 public:
-    enum State {
+    enum State : uint8_t {
         CLOSED,
         LISTEN,
         SYN_SENT,
@@ -37,139 +57,615 @@ public:
         TIME_WAIT
     };
 
-    TCPConnection(uint16_t sp, uint16_t dp, uint32_t ss_addr, uint32_t d_addr) {
+    static constexpr uint16_t DEFAULT_MSS = 1460;
+    static constexpr uint32_t RECEIVE_BUFFER_SIZE = 4 * 1024 * 1024;
+    static constexpr uint32_t SEND_BUFFER_SIZE = 4 * 1024 * 1024; // WRITABLE below this much queued data
+    static constexpr uint8_t WINDOW_SCALE = 7; // lets the advertised window cover RECEIVE_BUFFER_SIZE
+
+    // Timestamp option clock (RFC 7323 5.4): one tick per millisecond.
+    static uint32_t timestamp_clock() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Timers (retransmit, delayed ACK, persist, keepalive, TIME_WAIT) are armed
+    // on the shared wheel; without one the connection runs untimed.
+    TCPConnection(uint16_t sp, uint16_t dp, uint32_t ss_addr, uint32_t d_addr, TimerWheel* timers = nullptr) {
         state = CLOSED;
+        snd_wscale = 0;
+        rcv_wscale = WINDOW_SCALE;
+        ts_enabled = false;
+        sack_enabled = false;
+        in_recovery = false;
+        tlp_in_flight = false;
+        ecn_active = false;
+        ecn_echo = false;
+        armed_timers = 0;
         src_port = sp;
         dest_port = dp;
+        mss = DEFAULT_MSS;
         seq_num = 0;
         ack_num = 0;
+        snd_una = 0;
+        snd_wnd = 65535;
+        ts_recent = 0;
+        rcv_unacked = 0;
+        rcv_mss = MIN_RCV_MSS;
         src_ip = ss_addr;
         dest_ip = d_addr;
+        congestion_algorithm = CongestionControl::NEW_RENO;
+        congestion_control = CongestionControl::create(congestion_algorithm, mss);
+        timer_wheel = timers;
+        link = nullptr;
+        fast_open_cache = nullptr;
+        syn_data = 0;
+        dup_acks = 0;
+        snd_wl1 = 0;
+        snd_wl2 = 0;
+        recovery_point = 0;
+        tlp_end_seq = 0;
+        rack_end_seq = 0;
+        rack_rtt = std::chrono::microseconds(0);
+        persist_backoff = 0;
+        ecn_requested = false;
+        cwr_pending = false;
+        in_cwr = false;
+        cwr_point = 0;
+        nodelay = false;
+        corked = false;
+        push_partial = false;
+        delayed_ack_enabled = true;
+        keepalive_enabled = false;
+        keepalive_failed = false;
+        fin_pending = false;
+        keepalive_max_probes = 0;
+        keepalive_probes_sent = 0;
+        fast_path_acks = 0;
+        fast_path_data = 0;
+        slow_path_segments = 0;
+        connection_table = nullptr;
+        timer.set_callback([this] { handle_timers(); });
+        update_readiness();
+    }
+
+    ~TCPConnection() {
+        if (connection_table) {
+            connection_table->remove_connection(FlowKey(src_ip, src_port, dest_ip, dest_port), this);
+        }
+    }
+
+    // Selects the congestion controller for this connection, e.g. CUBIC for
+    // high-BDP links or BBR for lossy links. Resets the window to the initial value.
+    void set_congestion_control(CongestionControl::Algorithm algorithm) {
+        congestion_algorithm = algorithm;
+        congestion_control = CongestionControl::create(algorithm, mss);
+        if (algorithm == CongestionControl::DCTCP) {
+            ecn_requested = true;
+        }
+    }
+
+    // Offers ECN (RFC 3168) in our SYN. Selecting DCTCP turns it on.
+    void set_ecn(bool enabled) {
+        ecn_requested = enabled;
+    }
+
+    // Client side of TCP Fast Open (RFC 7413): with a cookie cached for the
+    // destination, the SYN carries it along with data queued by send()
+    // beforehand; without one the SYN asks for a cookie for next time.
+    void set_fast_open(FastOpenCache* cache) {
+        fast_open_cache = cache;
+    }
+
+    // Frames go out through `l`; without a link a raw socket is opened per frame.
+    // Behind a PacingQueue, data frames carry earliest departure times.
+    void set_link(Link* l) {
+        link = l;
+    }
+
+    // Adds the connection to `table` under its 4-tuple so received segments
+    // demux to it. It removes itself when destroyed; the table must outlive it.
+    bool add_to_table(ConnectionTable<TCPConnection, TCPListener>& table) {
+        if (!table.add_connection(FlowKey(src_ip, src_port, dest_ip, dest_port), this)) {
+            return false;
+        }
+        connection_table = &table;
+        return true;
+    }
+
+    // Completes a passive open whose SYN / SYN-ACK exchange was handled by a
+    // TCPListener: `iss` is our initial sequence number, `irs` the peer's and
+    // `peer_options` the options of its SYN that our SYN-ACK agreed to.
+    // `ecn` is set when the SYN-ACK accepted the peer's ECN request.
+    void establish_passive(uint32_t iss, uint32_t irs, const TCPOptions& peer_options, bool ecn = false) {
+        seq_num = iss + 1;
+        snd_una = seq_num;
+        ack_num = irs + 1;
+        snd_wl1 = irs;
+        snd_wl2 = iss;
+        apply_syn_options(peer_options);
+        ecn_active = ecn;
+        state = ESTABLISHED;
+        log("Handshake completed by listener, transitioning to ESTABLISHED");
+        restart_keepalive();
+        update_readiness();
+    }
+
+    // Passive open for a SYN whose Fast Open cookie a TCPListener accepted
+    // (RFC 7413 4.2.2): the SYN's data is readable at once, our SYN-ACK
+    // acknowledges it, and data may be sent before the handshake completes.
+    void accept_fast_open(uint32_t iss, const TCPSegment& syn, bool ecn = false) {
+        ack_num = ntohl(syn.seq_num) + 1;
+        apply_syn_options(syn.options);
+        ecn_active = ecn;
+        snd_wnd = ntohs(syn.window_size); // never scaled in a SYN
+        snd_wl1 = ntohl(syn.seq_num);
+        snd_wl2 = iss;
+        state = SYN_RECEIVED;
+        receive_buffer.append(syn.payload);
+        ack_num += static_cast<uint32_t>(syn.payload.size());
+
+        uint8_t flags = TCPSegment::SYN | TCPSegment::ACK | (ecn ? TCPSegment::ECE : 0);
+        send_segment(iss, flags, {});
+        log("Accepted Fast Open SYN with " + std::to_string(syn.payload.size()) + " bytes, sending SYN-ACK");
+        record_sent_segment(iss, iss + 1, flags);
+        arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+        // The send buffer starts after our SYN; its record stays queued until acknowledged
+        seq_num = iss + 1;
+        snd_una = seq_num;
+        update_readiness();
     }
 
     void send_syn() {
         if (state == CLOSED) {
-            TCPSegment syn_segment(src_port, dest_port, seq_num, ack_num, {}, TCPSegment::SYN);
-            std::vector<uint8_t> serialized_syn_segment = syn_segment.serialize();
-            IPPacket ip_syn_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_syn_segment);
-            std::vector<uint8_t> serialized_ip_syn_packet = ip_syn_packet.serialize();
-            EthernetFrame ethernet_syn_frame(dest_mac, src_mac, 0x0800, serialized_ip_syn_packet);
-            std::vector<uint8_t> serialized_ethernet_syn_frame = ethernet_syn_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_syn_frame);
+            // An ECN-setup SYN carries ECE and CWR (RFC 3168 6.1.1)
+            uint8_t flags = ecn_requested ? TCPSegment::SYN | TCPSegment::ECE | TCPSegment::CWR : TCPSegment::SYN;
+            std::vector<uint8_t> data;
+            const FastOpenCache::Entry* cookie = fast_open_cache ? fast_open_cache->lookup(IPAddress(dest_ip)) : nullptr;
+            if (cookie) {
+                data = send_buffer.copy(0, std::min<size_t>({ send_buffer.size(), cookie->mss, mss }));
+            }
+            send_segment(seq_num, flags, data);
             log("Sending SYN");
+            // Data in the SYN is not counted as sent; the SYN-ACK says how much of it the server took
+            record_sent_segment(seq_num, seq_num + 1, flags);
+            arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+            snd_una = seq_num;
+            seq_num++; // SYN occupies one sequence number
+            syn_data = static_cast<uint32_t>(data.size());
             state = SYN_SENT;
+            update_readiness();
         }
     }
 
     void receive_syn(const TCPSegment& segment) {
         if (state == LISTEN && (segment.flags & TCPSegment::SYN)) {
-            seq_num = segment.ack_num;
-            ack_num = segment.seq_num + 1;
+            seq_num = ntohl(segment.ack_num);
+            ack_num = ntohl(segment.seq_num) + 1;
             state = SYN_RECEIVED;
             log("Received SYN, transitioning to SYN_RECEIVED");
+            update_readiness();
         }
     }
 
+    // Any segment arriving in SYN_SENT (RFC 793 3.9). Only a SYN-ACK that
+    // acknowledges our SYN completes the handshake; an ACK of anything else
+    // is answered with a reset, and other segments are dropped.
     void receive_syn_ack(const TCPSegment& segment) {
-        if (state == SYN_SENT && (segment.flags & (TCPSegment::SYN | TCPSegment::ACK))) {
-            ack_num = segment.seq_num + 1;
-            TCPSegment ack_segment(src_port, dest_port, seq_num + 1, ack_num, {}, TCPSegment::ACK);
-            std::vector<uint8_t> serialized_ack_segment = ack_segment.serialize();
-            IPPacket ip_ack_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_ack_segment);
-            std::vector<uint8_t> serialized_ip_ack_packet = ip_ack_packet.serialize();
-            EthernetFrame ethernet_ack_frame(dest_mac, src_mac, 0x0800, serialized_ip_ack_packet);
-            std::vector<uint8_t> serialized_ethernet_ack_frame = ethernet_ack_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_ack_frame);
+        if (state != SYN_SENT || (segment.flags & TCPSegment::RST)) {
+            return;
+        }
+        uint32_t ack = ntohl(segment.ack_num);
+        // snd_una is still our ISS; the ACK may also cover Fast Open data in the SYN
+        if ((segment.flags & TCPSegment::ACK) && (!seq_after(ack, snd_una) || seq_after(ack, seq_num + syn_data))) {
+            send_segment(ack, TCPSegment::RST, {});
+            log("Unacceptable ACK in SYN_SENT, sending RST");
+            return;
+        }
+        if ((segment.flags & (TCPSegment::SYN | TCPSegment::ACK)) == (TCPSegment::SYN | TCPSegment::ACK)) {
+            ack_num = ntohl(segment.seq_num) + 1;
+            apply_syn_options(segment.options);
+            ecn_active = ecn_requested && (segment.flags & TCPSegment::ECE) && !(segment.flags & TCPSegment::CWR);
+            snd_wnd = ntohs(segment.window_size); // never scaled in a SYN
+            snd_wl1 = ntohl(segment.seq_num);
+            snd_wl2 = ack;
+            snd_una = seq_num;
+            receive_fast_open_reply(segment);
+            acknowledge_sent_segments(snd_una, std::chrono::steady_clock::now(), echoed_timestamp(segment));
+            send_segment(seq_num, TCPSegment::ACK, {});
             log("Received SYN-ACK, sending ACK");
+            cancel_timer(RETRANSMIT_TIMER);
             state = ESTABLISHED;
+            restart_keepalive();
+            output(); // data queued before the handshake, or left out of the SYN
+            update_readiness();
         }
     }
 
     void send_ack() {
         if (state == SYN_RECEIVED) {
-            TCPSegment ack_segment(src_port, dest_port, seq_num, ack_num, {}, TCPSegment::ACK);
-            std::vector<uint8_t> serialized_ack_segment = ack_segment.serialize();
-            IPPacket ip_ack_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_ack_segment);
-            std::vector<uint8_t> serialized_ip_ack_packet = ip_ack_packet.serialize();
-            EthernetFrame ethernet_ack_frame(dest_mac, src_mac, 0x0800, serialized_ip_ack_packet);
-            std::vector<uint8_t> serialized_ethernet_ack_frame = ethernet_ack_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_ack_frame);
+            send_segment(seq_num, TCPSegment::ACK, {});
             log("Sending ACK");
             state = ESTABLISHED;
+            update_readiness();
         }
     }
 
+    // Closes our direction: from ESTABLISHED (active close) or, once the
+    // peer has closed, from CLOSE_WAIT. The FIN follows the last queued
+    // byte, so it leaves once the windows have let all data out (RFC 793
+    // 3.5); the state changes at once.
     void send_fin() {
-        if (state == ESTABLISHED) {
-            TCPSegment fin_segment(src_port, dest_port, seq_num + 1, ack_num, {}, TCPSegment::FIN);
-            std::vector<uint8_t> serialized_fin_segment = fin_segment.serialize();
-            IPPacket ip_fin_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_fin_segment);
-            std::vector<uint8_t> serialized_ip_fin_packet = ip_fin_packet.serialize();
-            EthernetFrame ethernet_fin_frame(dest_mac, src_mac, 0x0800, serialized_ip_fin_packet);
-            std::vector<uint8_t> serialized_ethernet_fin_frame = ethernet_fin_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_fin_frame);
-            log("Sending FIN");
-            state = FIN_WAIT_1;
+        if (state == ESTABLISHED || state == CLOSE_WAIT) {
+            corked = false;
+            fin_pending = true;
+            // Flush first: a FIN with nothing queued ahead of it is logged
+            // from the state close() was called in
+            push_pending();
+            state = state == ESTABLISHED ? FIN_WAIT_1 : LAST_ACK;
+            update_readiness();
         }
     }
 
     void receive_ack_for_fin() {
         if (state == FIN_WAIT_1) {
             log("Received ACK for FIN");
+            sent_segments.clear();
+            cancel_timer(RETRANSMIT_TIMER);
+            cancel_timer(LOSS_PROBE_TIMER);
+            cancel_timer(REORDER_TIMER);
             state = FIN_WAIT_2;
         }
     }
 
     void receive_fin() {
         if (state == FIN_WAIT_2) {
-            TCPSegment ack_segment(src_port, dest_port, seq_num + 1, ack_num, {}, TCPSegment::ACK);
-            std::vector<uint8_t> serialized_ack_segment = ack_segment.serialize();
-            IPPacket ip_ack_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_ack_segment);
-            std::vector<uint8_t> serialized_ip_ack_packet = ip_ack_packet.serialize();
-            EthernetFrame ethernet_ack_frame(dest_mac, src_mac, 0x0800, serialized_ip_ack_packet);
-            std::vector<uint8_t> serialized_ethernet_ack_frame = ethernet_ack_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_ack_frame);
+            send_segment(seq_num, TCPSegment::ACK, {});
             log("Received FIN, sending ACK");
             state = TIME_WAIT;
+            cancel_timers();
+            arm_timer(TIME_WAIT_TIMER, 2 * MSL);
         }
         else if (state == ESTABLISHED) {
             log("Received FIN in ESTABLISHED state, transitioning to CLOSE_WAIT");
             state = CLOSE_WAIT;
         }
         else if (state == CLOSE_WAIT) {
-            TCPSegment ack_segment(src_port, dest_port, seq_num + 1, ack_num, {}, TCPSegment::ACK);
-            std::vector<uint8_t> serialized_ack_segment = ack_segment.serialize();
-            IPPacket ip_ack_packet(IPPROTO_TCP, src_ip, dest_ip, serialized_ack_segment);
-            std::vector<uint8_t> serialized_ip_ack_packet = ip_ack_packet.serialize();
-            EthernetFrame ethernet_ack_frame(dest_mac, src_mac, 0x0800, serialized_ip_ack_packet);
-            std::vector<uint8_t> serialized_ethernet_ack_frame = ethernet_ack_frame.serialize();
-            send_ethernet_frame(serialized_ethernet_ack_frame);
+            send_segment(seq_num, TCPSegment::ACK, {});
             log("Received FIN in CLOSE_WAIT, sending ACK and transitioning to LAST_ACK");
             state = LAST_ACK;
         }
+        update_readiness();
     }
 
     void receive_ack() {
         if (state == LAST_ACK) {
             log("Received ACK in LAST_ACK, transitioning to CLOSED");
             state = CLOSED;
+            cancel_timers();
+            update_readiness();
+        }
+    }
+
+    // Queues application data and sends as much as the congestion and peer windows allow.
+    void send(const std::vector<uint8_t>& data) {
+        send_buffer.append(data);
+        send_queued();
+    }
+
+    // Zero-copy completions go to `completions`; see send_zerocopy().
+    void set_completion_queue(CompletionQueue* completions) {
+        send_buffer.set_completion_queue(completions);
+    }
+
+    // Like send(), but the send buffer references `data` instead of copying
+    // it: segments and retransmissions read it in place. The memory must stay
+    // unchanged until `id` appears on the completion queue, once the peer has
+    // acknowledged all of it. False without a completion queue.
+    bool send_zerocopy(const uint8_t* data, size_t length, uint64_t id) {
+        if (!send_buffer.append_reference(data, length, id)) {
+            return false;
+        }
+        send_queued();
+        return true;
+    }
+
+    // Nagle's algorithm (RFC 896) holds back a partial segment while data is
+    // unacknowledged. It is on by default; `true` turns it off, like TCP_NODELAY.
+    void set_nodelay(bool enabled) {
+        nodelay = enabled;
+        if (nodelay) {
+            output();
+        }
+    }
+
+    // With delayed ACKs off, every data segment is acknowledged at once.
+    void set_delayed_ack(bool enabled) {
+        delayed_ack_enabled = enabled;
+        if (!enabled && timer_armed(DELAYED_ACK_TIMER)) {
+            send_pure_ack();
+        }
+    }
+
+    // While corked only full segments leave; a partial one waits for
+    // uncork() or at most CORK_TIMEOUT, so several small writes share a packet.
+    void cork() {
+        corked = true;
+    }
+
+    void uncork() {
+        corked = false;
+        push_pending();
+    }
+
+    // Processes the acknowledgment carried by an incoming segment.
+    void receive_ack(const TCPSegment& segment) {
+        if (!(segment.flags & TCPSegment::ACK)) {
+            return;
         }
+        auto now = std::chrono::steady_clock::now();
+        uint32_t ack = ntohl(segment.ack_num);
+        if (state == LAST_ACK && !fin_pending && ack == seq_num) {
+            receive_ack();
+            return;
+        }
+        if (state == SYN_RECEIVED) {
+            // Fast Open: the ACK of our SYN-ACK completes the handshake
+            if (seq_before(ack, snd_una) || seq_after(ack, seq_num)) {
+                return;
+            }
+            acknowledge_sent_segments(snd_una, now, echoed_timestamp(segment));
+            state = ESTABLISHED;
+            log("Received ACK of SYN-ACK, transitioning to ESTABLISHED");
+            update_readiness();
+            if (bytes_in_flight() == 0) {
+                cancel_timer(RETRANSMIT_TIMER);
+            }
+        }
+        update_send_window(segment, ack);
+        update_ts_recent(segment);
+        restart_keepalive();
+
+        if (sack_enabled) {
+            for (uint8_t i = 0; i < segment.options.sack_count; i++) {
+                mark_sacked(segment.options.sack_blocks[i], now);
+            }
+        }
+
+        if (seq_after(ack, snd_una) && !seq_after(ack, seq_num)) {
+            acknowledge(ack, echoed_timestamp(segment), (segment.flags & TCPSegment::ECE) != 0, now);
+        }
+        else if (!sack_enabled && ack == snd_una && segment.payload.empty() && !sent_segments.empty()) {
+            // Without SACK information RACK is off (see rack_detect_loss()),
+            // so the classic third duplicate ACK starts fast retransmit.
+
+            if (++dup_acks == 3) {
+                sent_segments.mark_lost(0);
+            }
+        }
+
+        if (state == FIN_WAIT_1 && !fin_pending && ack == seq_num) {
+            receive_ack_for_fin();
+            return;
+        }
+
+        detect_and_recover_losses(now);
+        output();
+
+        // Zero window with data waiting: probe it instead of waiting for a window update
+        if (snd_wnd == 0 && bytes_in_flight() == 0 && !send_buffer.empty()) {
+            if (!timer_armed(PERSIST_TIMER)) {
+                arm_timer(PERSIST_TIMER, persist_interval());
+            }
+        }
+        else {
+            cancel_timer(PERSIST_TIMER);
+            persist_backoff = 0;
+        }
+
+        schedule_loss_probe();
+    }
+
+    // Processes one incoming segment: its acknowledgment, data and FIN.
+    // `dscp_ecn` is the TOS byte of the IP header that carried it. Segments
+    // matching the header prediction skip the general path.
+    void receive_segment(const TCPSegment& segment, uint8_t dscp_ecn = 0) {
+        bool ce = (dscp_ecn & IPPacket::ECN_MASK) == IPPacket::ECN_CE;
+        if (!ce && !ecn_echo && predicted_segment(segment)) {
+            return;
+        }
+        slow_path_segments++;
+        receive_ack(segment);
+        receive_data(segment, dscp_ecn);
+        if ((segment.flags & TCPSegment::FIN) && ntohl(segment.seq_num) + segment.payload.size() == ack_num
+            && (state == ESTABLISHED || state == FIN_WAIT_2)) {
+            ack_num++; // the FIN takes one sequence number
+            receive_fin();
+            if (state == CLOSE_WAIT) {
+                send_pure_ack();
+            }
+        }
+    }
+
+    // Accepts data within the receive window. As in RFC 793 3.9, bytes already
+    // received and bytes beyond the window are trimmed off, so overlapping
+    // retransmissions still deliver their new data. In-order data is
+    // acknowledged after the delayed ACK timeout; data beyond a hole is held
+    // for reassembly and reported to the sender in SACK blocks.
+    void receive_data(const TCPSegment& segment, uint8_t dscp_ecn = 0) {
+        if (segment.payload.empty() || (state != ESTABLISHED && state != FIN_WAIT_1 && state != FIN_WAIT_2)) {
+            return;
+        }
+
+        receive_ecn(segment.flags, (dscp_ecn & IPPacket::ECN_MASK) == IPPacket::ECN_CE);
+        restart_keepalive();
+        update_ts_recent(segment);
+        uint32_t seq = ntohl(segment.seq_num);
+        const uint8_t* data = segment.payload.data();
+        uint32_t length = static_cast<uint32_t>(segment.payload.size());
+        if (seq_before(seq, ack_num)) {
+            uint32_t duplicate = std::min(ack_num - seq, length);
+            data += duplicate;
+            length -= duplicate;
+            seq += duplicate;
+        }
+        uint32_t window = receive_space();
+        uint32_t offset = seq - ack_num;
+        length = offset < window ? std::min(length, window - offset) : 0;
+
+        if (length == 0 || seq != ack_num) {
+            if (length > 0 && (!reassembly || reassembly->segments.count(seq) == 0)) {
+                if (!reassembly) {
+                    reassembly.reset(new Reassembly());
+                }
+                reassembly->segments[seq].assign(data, data + length);
+                reassembly->bytes += length;
+                reassembly->last_seq = seq;
+            }
+            // Out of order, duplicate or outside the window: ACK immediately so the sender can recover
+            send_pure_ack();
+            return;
+        }
+
+        deliver_in_order(data, length);
+    }
+
+    // Moves received in-order data to the application.
+    size_t receive(std::vector<uint8_t>& data) {
+        data = receive_buffer.copy(0, receive_buffer.size());
+        receive_buffer.clear();
+        buffer_drained();
+        update_readiness();
+        return data.size();
+    }
+
+    // Moves up to `max_length` received bytes to `data`; returns the count.
+    size_t receive(uint8_t* data, size_t max_length) {
+        size_t length = std::min(max_length, receive_buffer.size());
+        receive_buffer.copy(0, length, data);
+        receive_buffer.consume(length);
+        if (receive_buffer.empty()) {
+            buffer_drained();
+        }
+        update_readiness();
+        return length;
+    }
+
+    // Sends keepalive probes after `idle` without traffic, every `interval`,
+    // and closes the connection after `probes` unanswered probes.
+    void enable_keepalive(std::chrono::seconds idle = std::chrono::hours(2), std::chrono::seconds interval = std::chrono::seconds(75), uint32_t probes = 9) {
+        keepalive_enabled = true;
+        keepalive_idle = idle;
+        keepalive_interval = interval;
+        keepalive_max_probes = probes;
+        restart_keepalive();
+    }
+
+    // Current readiness as EventPoller events: READABLE with data or the
+    // peer's FIN to read, WRITABLE while the send buffer is below
+    // SEND_BUFFER_SIZE, HANGUP once closed in both directions (or never
+    // opened, as Linux reports) and FAILURE when keepalive gave up.
+    uint32_t poll_events() const {
+        uint32_t events = 0;
+        bool fin_received = state == CLOSE_WAIT || state == CLOSING || state == LAST_ACK || state == TIME_WAIT;
+        if (!receive_buffer.empty() || fin_received) {
+            events |= EventPoller::READABLE;
+        }
+        if ((state == ESTABLISHED || state == CLOSE_WAIT || state == SYN_RECEIVED) && send_buffer.size() < SEND_BUFFER_SIZE) {
+            events |= EventPoller::WRITABLE;
+        }
+        if (state == CLOSED || state == CLOSING || state == LAST_ACK || state == TIME_WAIT) {
+            events |= EventPoller::HANGUP;
+        }
+        if (keepalive_failed) {
+            events |= EventPoller::FAILURE;
+        }
+        return events;
+    }
+
+    // Register with an EventPoller to be told when poll_events() changes.
+    EventPoller::Source& get_poll_source() {
+        return readiness;
+    }
+
+    uint32_t bytes_in_flight() const {
+        return seq_num - snd_una;
+    }
+
+    const RTTEstimator& get_rtt_estimator() const {
+        return rtt_estimator;
+    }
+
+    uint32_t get_cwnd() const {
+        return congestion_control->cwnd();
+    }
+
+    uint64_t get_pacing_rate() const {
+        return congestion_control->pacing_rate();
+    }
+
+    const char* get_congestion_control_name() const {
+        return congestion_control->name();
+    }
+
+    // Header prediction counters for receive_segment()
+    uint64_t get_fast_path_acks() const {
+        return fast_path_acks;
+    }
+
+    uint64_t get_fast_path_data() const {
+        return fast_path_data;
+    }
+
+    uint64_t get_slow_path_segments() const {
+        return slow_path_segments;
+    }
+
+    // Peer window, after window scaling
+    uint32_t get_send_window() const {
+        return snd_wnd;
+    }
+
+    bool timestamps_enabled() const {
+        return ts_enabled;
+    }
+
+    bool sack_permitted() const {
+        return sack_enabled;
+    }
+
+    bool ecn_enabled() const {
+        return ecn_active;
     }
 
+    // Retransmission timer expiry: everything outstanding is presumed lost.
+    // The oldest segment is resent now and the rest as the window reopens
+    // (RFC 6298 5.4-5.6).
     void handle_timeout() {
+        if (sent_segments.empty()) {
+            return;
+        }
+
         auto now = std::chrono::steady_clock::now();
-        if (now - last_sent_time > timeout_duration) {
-            log("Timeout occurred, retransmitting last segment");
-            retransmit_last_segment();
-            last_sent_time = now;
+        log("Timeout occurred, retransmitting oldest unacknowledged segment");
+        congestion_control->on_timeout(bytes_in_flight(), now);
+        in_recovery = true;
+        recovery_point = seq_num;
+        tlp_in_flight = false;
+        cancel_timer(LOSS_PROBE_TIMER);
+        cancel_timer(REORDER_TIMER);
+
+        for (size_t i = 0; i < sent_segments.size(); i++) {
+            sent_segments.mark_lost(i);
         }
+        retransmit_segment(0, now);
+
+        rtt_estimator.backoff();
+        arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
     }
 
     void retransmit_last_segment() {
         if (!sent_segments.empty()) {
-            auto last_segment = sent_segments.rbegin();
-            send_ethernet_frame(last_segment->second);
-            log("Retransmitting segment with seq_num: " + std::to_string(last_segment->first));
+            retransmit_segment(sent_segments.size() - 1, std::chrono::steady_clock::now());
+            log("Retransmitting segment with seq_num: " + std::to_string(sent_segments.back().seq));
         }
     }
 
@@ -181,6 +677,22 @@ public:
         return state;
     }
 
+    uint16_t get_src_port() const {
+        return src_port;
+    }
+
+    uint16_t get_dest_port() const {
+        return dest_port;
+    }
+
+    uint32_t get_src_ip() const {
+        return src_ip;
+    }
+
+    uint32_t get_dest_ip() const {
+        return dest_ip;
+    }
+
     std::string state_to_string() const {
         switch (state) {
         case CLOSED: return "CLOSED";
@@ -199,20 +711,989 @@ public:
     }
 
 private:
+    // Timer events multiplexed onto the connection's single wheel timer
+    enum TimerEvent {
+        RETRANSMIT_TIMER,
+        REORDER_TIMER,
+        LOSS_PROBE_TIMER,
+        DELAYED_ACK_TIMER,
+        CORK_TIMER,
+        PERSIST_TIMER,
+        KEEPALIVE_TIMER,
+        TIME_WAIT_TIMER,
+        BUFFER_IDLE_TIMER,
+        TIMER_EVENTS
+    };
+
+    // Data held beyond a hole, allocated when the first out-of-order segment arrives
+    struct Reassembly {
+        std::map<uint32_t, std::vector<uint8_t>> segments; // keyed by sequence number
+        uint32_t bytes = 0;
+        uint32_t last_seq = 0; // reported in the first SACK block
+    };
+
+    // First cache line: connection state, sequence space and negotiated options
     State state;
+    uint8_t snd_wscale; // shift applied to windows the peer advertises (RFC 7323)
+    bool ts_enabled;
+    bool sack_enabled; // RFC 2018
+    bool in_recovery;
+    bool tlp_in_flight;
+    bool ecn_active; // negotiated ECN (RFC 3168)
+    bool ecn_echo;   // set ECE on our ACKs
+    uint16_t armed_timers; // bit per TimerEvent
     uint16_t src_port;
     uint16_t dest_port;
-    uint32_t seq_num;
-    uint32_t ack_num;
+    uint16_t mss;
+    uint32_t seq_num; // snd_nxt
+    uint32_t ack_num; // rcv_nxt
+    uint32_t snd_una;
+    uint32_t snd_wnd;
+    uint32_t snd_wl1; // sequence number of the segment that last set snd_wnd
+    uint32_t ts_recent;
+
+    uint32_t rcv_unacked; // bytes received since our last ACK
+    uint32_t rcv_mss;     // largest segment seen from the peer
     uint32_t src_ip;
     uint32_t dest_ip;
+    std::unique_ptr<Reassembly> reassembly;
+
+    // Transmit and loss recovery
+    std::unique_ptr<CongestionControl> congestion_control;
+    TimerWheel* timer_wheel;
+    Link* link;
+    FastOpenCache* fast_open_cache;
+    SendBuffer send_buffer; // data from snd_una onwards
+    ByteRing receive_buffer;
+    RetransmitQueue sent_segments; // unacknowledged segments; payloads stay in send_buffer
+    RTTEstimator rtt_estimator;
+    uint32_t dup_acks;
+    uint32_t snd_wl2; // acknowledgment number of the segment that last set snd_wnd
+    uint32_t recovery_point;
+    uint32_t tlp_end_seq;
+    // RACK state (RFC 8985): the most recently sent segment known to be delivered
+    uint32_t rack_end_seq;
+    std::chrono::steady_clock::time_point rack_xmit_time;
+    std::chrono::microseconds rack_rtt;
+    std::chrono::steady_clock::time_point pacing_time; // earliest departure of the next data frame
+
+    TimerWheel::Timer timer; // fires at the earliest armed deadline
+    TimerWheel::Clock::time_point timer_expiry;
+    TimerWheel::Clock::time_point timer_deadlines[TIMER_EVENTS];
+
     uint8_t dest_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
     uint8_t src_mac[6] = { 0x00, 0x0c, 0x29, 0x36, 0xbc, 0x17 };
-    std::map<uint32_t, std::vector<uint8_t>> sent_segments;
-    std::chrono::steady_clock::time_point last_sent_time;
-    const std::chrono::seconds timeout_duration = std::chrono::seconds(3);
+    bool nodelay;
+    bool corked;
+    bool push_partial; // send a partial segment despite Nagle and cork
+    bool delayed_ack_enabled;
+    bool keepalive_enabled;
+    bool keepalive_failed; // reported as EventPoller::FAILURE
+    bool fin_pending;      // closed by send_fin(); the FIN waits for queued data
+    uint8_t rcv_wscale;    // shift applied to windows we advertise
+
+    uint32_t persist_backoff;
+    bool ecn_requested;
+    bool cwr_pending; // put CWR on the next new data segment
+    bool in_cwr;      // window already reduced for ECE until snd_una reaches cwr_point
+    uint32_t cwr_point;
+    CongestionControl::Algorithm congestion_algorithm;
+
+
+    uint32_t syn_data; // bytes carried in our Fast Open SYN
+    uint32_t keepalive_max_probes;
+    uint32_t keepalive_probes_sent;
+    std::chrono::seconds keepalive_idle;
+    std::chrono::seconds keepalive_interval;
+    uint64_t fast_path_acks;
+    uint64_t fast_path_data;
+    uint64_t slow_path_segments;
+    EventPoller::Source readiness; // poll_events(), kept current for a registered poller
+    ConnectionTable<TCPConnection, TCPListener>* connection_table; // set by add_to_table()
+
+
+    static constexpr std::chrono::seconds MSL{ 30 };
+    static constexpr std::chrono::seconds MAX_RTO{ 60 };
+    static constexpr std::chrono::milliseconds DELAYED_ACK_TIMEOUT{ 40 };
+    static constexpr std::chrono::milliseconds CORK_TIMEOUT{ 200 };
+    static constexpr std::chrono::seconds BUFFER_IDLE_TIMEOUT{ 1 };
+    static constexpr uint32_t MIN_RCV_MSS = 536; // receive MSS estimate until segments arrive
+    static constexpr uint16_t MIN_PEER_MSS = 88; // floor on the peer's MSS option, as Linux's TCP_MIN_MSS
+    // RFC 8985 suggests 200 ms for arbitrary peers; our own delayed ACK bound is used instead
+    static constexpr std::chrono::milliseconds WORST_CASE_ACK_DELAY = DELAYED_ACK_TIMEOUT;
+
+    // Records the event's deadline and pulls the wheel timer in if it is earlier.
+    void arm_timer(TimerEvent event, TimerWheel::Clock::duration delay) {
+        if (!timer_wheel) {
+            return;
+        }
+        TimerWheel::Clock::time_point deadline = timer_wheel->now() + delay;
+        timer_deadlines[event] = deadline;
+        armed_timers |= 1 << event;
+        if (!timer.is_armed() || deadline < timer_expiry) {
+            timer_expiry = deadline;
+            timer_wheel->schedule_at(timer, deadline);
+        }
+    }
+
+    // The wheel timer is left alone; if it fires for a cancelled event,
+    // handle_timers() finds nothing due and re-arms for the next one.
+    void cancel_timer(TimerEvent event) {
+        armed_timers &= ~(1 << event);
+        if (armed_timers == 0) {
+            timer.cancel();
+        }
+    }
+
+    bool timer_armed(TimerEvent event) const {
+        return (armed_timers & (1 << event)) != 0;
+    }
+
+    void cancel_timers() {
+        armed_timers &= (1 << TIME_WAIT_TIMER) | (1 << BUFFER_IDLE_TIMER);
+        if (armed_timers == 0) {
+            timer.cancel();
+        }
+    }
+
+    void handle_timers() {
+        TimerWheel::Clock::time_point now = timer_wheel->now();
+        for (int event = 0; event < TIMER_EVENTS; event++) {
+            if (timer_armed(static_cast<TimerEvent>(event)) && timer_deadlines[event] <= now) {
+                armed_timers &= ~(1 << event);
+                fire_timer(static_cast<TimerEvent>(event));
+            }
+        }
+
+        // Handlers may have armed the timer already; make sure it covers the earliest deadline
+        bool any = false;
+        TimerWheel::Clock::time_point next;
+        for (int event = 0; event < TIMER_EVENTS; event++) {
+            if (timer_armed(static_cast<TimerEvent>(event)) && (!any || timer_deadlines[event] < next)) {
+                next = timer_deadlines[event];
+                any = true;
+            }
+        }
+        if (any && (!timer.is_armed() || next < timer_expiry)) {
+            timer_expiry = next;
+            timer_wheel->schedule_at(timer, next);
+        }
+    }
+
+    void fire_timer(TimerEvent event) {
+        switch (event) {
+        case RETRANSMIT_TIMER:
+            handle_timeout();
+            break;
+        case REORDER_TIMER:
+            detect_and_recover_losses(std::chrono::steady_clock::now());
+            break;
+        case LOSS_PROBE_TIMER:
+            handle_loss_probe();
+            break;
+        case DELAYED_ACK_TIMER:
+            send_pure_ack();
+            break;
+        case CORK_TIMER:
+            push_pending();
+            break;
+        case PERSIST_TIMER:
+            handle_persist_timeout();
+            break;
+        case KEEPALIVE_TIMER:
+            handle_keepalive_timeout();
+            break;
+        case BUFFER_IDLE_TIMER:
+            send_buffer.release();
+            receive_buffer.release();
+            break;
+        case TIME_WAIT_TIMER:
+            log("2MSL timer expired, transitioning to CLOSED");
+            state = CLOSED;
+            update_readiness();
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::chrono::microseconds persist_interval() const {
+        return std::min<std::chrono::microseconds>(rtt_estimator.rto() * (1 << std::min<uint32_t>(persist_backoff, 6)), MAX_RTO);
+    }
+
+    void handle_persist_timeout() {
+        size_t offset = seq_num - snd_una;
+        if (offset < send_buffer.size()) {
+            // One byte beyond the window; snd_nxt is not advanced
+            send_segment(seq_num, TCPSegment::ACK, std::vector<uint8_t>(1, send_buffer[offset]));
+            log("Sending zero window probe");
+        }
+        persist_backoff++;
+        arm_timer(PERSIST_TIMER, persist_interval());
+    }
+
+    void update_readiness() {
+        readiness.set_events(poll_events());
+    }
+
+    // A drained buffer keeps its storage for BUFFER_IDLE_TIMEOUT, so steady
+    // traffic reuses it; untimed connections free it at once.
+    void buffer_drained() {
+        if (!timer_wheel) {
+            send_buffer.release();
+            receive_buffer.release();
+        }
+        else if (!timer_armed(BUFFER_IDLE_TIMER)) {
+            arm_timer(BUFFER_IDLE_TIMER, BUFFER_IDLE_TIMEOUT);
+        }
+    }
+
+    void restart_keepalive() {
+        keepalive_probes_sent = 0;
+        if (keepalive_enabled && state == ESTABLISHED) {
+            arm_timer(KEEPALIVE_TIMER, keepalive_idle);
+        }
+    }
+
+    void handle_keepalive_timeout() {
+        if (keepalive_probes_sent >= keepalive_max_probes) {
+            log("Keepalive probes unanswered, transitioning to CLOSED");
+            state = CLOSED;
+            keepalive_failed = true;
+            cancel_timers();
+            update_readiness();
+            return;
+        }
+        // Probe with an already acknowledged sequence number to elicit an ACK
+        send_segment(snd_una - 1, TCPSegment::ACK, {});
+        keepalive_probes_sent++;
+        arm_timer(KEEPALIVE_TIMER, keepalive_interval);
+    }
+
+    void send_pure_ack() {
+        send_segment(seq_num, TCPSegment::ACK, {});
+    }
+
+    // Sends new data while the usable window min(cwnd, snd_wnd) allows it.
+    // Anything larger than one segment goes down as a single large send.
+    // After a close, data still queued keeps going out and the FIN follows it.
+    void output() {
+        if (state != ESTABLISHED && state != CLOSE_WAIT && state != SYN_RECEIVED && state != FIN_WAIT_1 && state != LAST_ACK) {
+            return;
+        }
+
+        uint32_t window = std::min(congestion_control->cwnd(), snd_wnd);
+        while (true) {
+            size_t offset = seq_num - snd_una;
+            uint32_t in_flight = bytes_in_flight();
+            if (offset >= send_buffer.size() || in_flight >= window) {
+                break;
+            }
+
+            size_t length = std::min<size_t>({ SegmentationOffload::MAX_SEND_SIZE, send_buffer.size() - offset, window - in_flight });
+            if (length % mss != 0 && hold_partial_segment()) {
+                length -= length % mss;
+                if (length == 0) {
+                    break;
+                }
+            }
+            if (length > mss) {
+                send_large(seq_num, offset, length);
+            }
+            else {
+                send_data(seq_num, offset, length);
+            }
+            seq_num += static_cast<uint32_t>(length);
+        }
+        if (fin_pending && seq_num - snd_una == send_buffer.size()) {
+            output_fin();
+        }
+        schedule_loss_probe();
+    }
+
+    void output_fin() {
+        fin_pending = false;
+        send_segment(seq_num, TCPSegment::FIN, {});
+        log("Sending FIN");
+        record_sent_segment(seq_num, seq_num + 1, TCPSegment::FIN);
+        if (!timer_armed(RETRANSMIT_TIMER)) {
+            arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+        }
+        seq_num++;
+    }
+
+    // Closing flushes: the last partial segment is not held back
+    bool hold_partial_segment() const {
+        if (push_partial || fin_pending) {
+            return false;
+        }
+        return corked || (!nodelay && bytes_in_flight() > 0);
+    }
+
+    // Sends everything the windows allow, the last partial segment included.
+    void push_pending() {
+        cancel_timer(CORK_TIMER);
+        push_partial = true;
+        output();
+        push_partial = false;
+    }
+
+    void send_queued() {
+        output();
+        if (corked && !timer_armed(CORK_TIMER) && seq_num - snd_una < send_buffer.size()) {
+            arm_timer(CORK_TIMER, CORK_TIMEOUT);
+        }
+        update_readiness();
+    }
+
+    void send_data(uint32_t seq, size_t offset, size_t length) {
+        send_segment(seq, TCPSegment::ACK | TCPSegment::PSH | cwr_flag(), send_buffer.copy(offset, length), ecn_active);
+        record_sent_segment(seq, seq + static_cast<uint32_t>(length), TCPSegment::ACK | TCPSegment::PSH);
+        if (!timer_armed(RETRANSMIT_TIMER)) {
+            arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+        }
+    }
+
+    // Builds one header template for `length` bytes and lets the segmentation
+    // offload cut it into MSS-sized frames, which leave in one link burst.
+    // Data from a zero-copy send goes from application memory to the frames.
+    void send_large(uint32_t seq, size_t offset, size_t length) {
+        std::vector<uint8_t> payload;
+        const uint8_t* data = send_buffer.contiguous(offset, length);
+        if (!data) {
+            payload = send_buffer.copy(offset, length);
+            data = payload.data();
+        }
+        uint8_t flags = TCPSegment::ACK | TCPSegment::PSH;
+        TCPSegment header = build_segment(seq, flags | cwr_flag(), {});
+        IPPacket ip_packet(IPPROTO_TCP, src_ip, dest_ip, header.serialize());
+        if (ecn_active) {
+            ip_packet.set_dscp_ecn(IPPacket::ECN_ECT0);
+        }
+        EthernetFrame ethernet_frame(dest_mac, src_mac, 0x0800, ip_packet.serialize());
+
+        std::vector<std::vector<uint8_t>> frames;
+        SegmentationOffload::segment_tcp(ethernet_frame.serialize(), data, length, mss, frames);
+        send_ethernet_burst(frames);
+        cancel_timer(DELAYED_ACK_TIMER);
+        rcv_unacked = 0;
+
+        for (size_t piece = 0; piece < length; piece += mss) {
+            size_t end = std::min<size_t>(piece + mss, length);
+            uint8_t piece_flags = end == length ? flags : static_cast<uint8_t>(TCPSegment::ACK);
+
+            record_sent_segment(seq + static_cast<uint32_t>(piece), seq + static_cast<uint32_t>(end), piece_flags);
+        }
+        if (!timer_armed(RETRANSMIT_TIMER)) {
+            arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+        }
+    }
+
+    // `ect` marks the packet ECN-capable; only new data is (RFC 3168 6.1.5).
+    std::vector<uint8_t> send_segment(uint32_t seq, uint8_t flags, const std::vector<uint8_t>& payload, bool ect = false) {
+        TCPSegment segment = build_segment(seq, flags, payload);
+        IPPacket ip_packet(IPPROTO_TCP, src_ip, dest_ip, segment.serialize(src_ip, dest_ip));
+        if (ect) {
+            ip_packet.set_dscp_ecn(IPPacket::ECN_ECT0);
+        }
+        EthernetFrame ethernet_frame(dest_mac, src_mac, 0x0800, ip_packet.serialize());
+        std::vector<uint8_t> frame = ethernet_frame.serialize();
+        if (!payload.empty() && pacing()) {
+            link->transmit_at(frame, departure_time(frame.size()));
+        }
+        else {
+            send_ethernet_frame(frame);
+        }
+        // Every segment we send carries the latest acknowledgment
+        if (flags & TCPSegment::ACK) {
+            cancel_timer(DELAYED_ACK_TIMER);
+            rcv_unacked = 0;
+        }
+        return frame;
+    }
+
+    // Segment with the current acknowledgment, window and options
+    TCPSegment build_segment(uint32_t seq, uint8_t flags, const std::vector<uint8_t>& payload) const {
+        if (ecn_echo && (flags & TCPSegment::ACK) && !(flags & TCPSegment::SYN)) {
+            flags |= TCPSegment::ECE;
+        }
+        TCPSegment segment(src_port, dest_port, seq, ack_num, payload, flags);
+        segment.window_size = htons(advertised_window(flags & TCPSegment::SYN));
+        if (flags & TCPSegment::SYN) {
+            segment.options = syn_options();
+        }
+        else {
+            if (ts_enabled) {
+                segment.options.has_timestamp = true;
+                segment.options.ts_val = timestamp_clock();
+                segment.options.ts_ecr = ts_recent;
+            }
+            if (sack_enabled && (flags & TCPSegment::ACK)) {
+                fill_sack_blocks(segment.options);
+            }
+        }
+        return segment;
+    }
+
+    void record_sent_segment(uint32_t seq, uint32_t end_seq, uint8_t flags) {
+        sent_segments.push_back({ seq, end_seq, flags, false, false, false, std::chrono::steady_clock::now() });
+    }
+
+    // Rebuilds the segment so it carries the current acknowledgment, window and timestamp.
+    void retransmit_segment(size_t index, std::chrono::steady_clock::time_point now) {
+        const SentSegment& sent = sent_segments[index];
+        uint32_t length = sent.end_seq - sent.seq;
+        if (sent.flags & (TCPSegment::SYN | TCPSegment::FIN)) {
+            length--;
+        }
+        size_t offset = sent.seq - snd_una;
+        std::vector<uint8_t> payload;
+        if (length > 0 && offset + length <= send_buffer.size()) {
+            payload = send_buffer.copy(offset, length);
+        }
+        send_segment(sent.seq, sent.flags, payload);
+        sent_segments.mark_resent(index, now);
+    }
+
+    // Appends in-order data at ack_num, pulls in held segments it made
+    // contiguous and applies the ACK policy.
+    void deliver_in_order(const uint8_t* data, uint32_t length) {
+        receive_buffer.append(data, length);
+        ack_num += length;
+        rcv_unacked += length;
+        rcv_mss = std::max<uint32_t>(rcv_mss, std::min<uint32_t>(length, mss));
+
+        // Pull in held segments the new data made contiguous
+        bool filled_hole = false;
+        if (reassembly) {
+            auto& segments = reassembly->segments;
+            auto it = segments.begin();
+            while (it != segments.end() && !seq_after(it->first, ack_num)) {
+                uint32_t end = it->first + static_cast<uint32_t>(it->second.size());
+                if (seq_after(end, ack_num)) {
+                    receive_buffer.append(it->second.data() + it->second.size() - (end - ack_num), end - ack_num);
+                    ack_num = end;
+                }
+                reassembly->bytes -= static_cast<uint32_t>(it->second.size());
+                it = segments.erase(it);
+                filled_hole = true;
+            }
+            if (segments.empty()) {
+                reassembly.reset();
+            }
+        }
+
+        // RFC 1122 4.2.3.2: ACK at least every second full-sized segment. A
+        // merged GRO segment is acknowledged once, however many it carried.
+        if (filled_hole || !delayed_ack_enabled || rcv_unacked >= 2 * rcv_mss) {
+            send_pure_ack(); // RFC 5681 4.2: also ACK at once when a hole is filled
+        }
+        else if (!timer_armed(DELAYED_ACK_TIMER)) {
+            arm_timer(DELAYED_ACK_TIMER, DELAYED_ACK_TIMEOUT);
+        }
+        update_readiness();
+    }
+
+    // Processes a cumulative acknowledgment of new data.
+    // `ece` is set when the ACK echoed congestion experienced.
+    void acknowledge(uint32_t ack, uint32_t ts_ecr, bool ece, std::chrono::steady_clock::time_point now) {
+        uint32_t acked = ack - snd_una;
+        send_buffer.consume(std::min<size_t>(acked, send_buffer.size()));
+        if (send_buffer.empty()) {
+            buffer_drained();
+        }
+        snd_una = ack;
+
+        dup_acks = 0;
+        acknowledge_sent_segments(ack, now, ts_ecr);
+        if (in_recovery && !seq_before(ack, recovery_point)) {
+            in_recovery = false;
+            congestion_control->on_recovery_end(now);
+        }
+        else if (in_recovery && !sack_enabled && !sent_segments.empty() && !sent_segments.front().retransmitted) {
+            // NewReno partial ACK (RFC 6582 3.2 step 5): the next hole is lost
+            // too; it is resent at once, whatever the window
+            retransmit_segment(0, now);
+            log("Partial ACK, retransmitting segment with seq_num: " + std::to_string(sent_segments.front().seq));
+        }
+
+        if (tlp_in_flight && !seq_before(ack, tlp_end_seq)) {
+            tlp_in_flight = false;
+        }
+        congestion_control->on_ack(acked, bytes_in_flight(), now);
+        if (ecn_active) {
+            receive_ecn_echo(acked, ece, now);
+        }
+
+        // RFC 6298 (5.2, 5.3): stop the timer when all data is acked, else restart it
+        if (bytes_in_flight() == 0) {
+            cancel_timer(RETRANSMIT_TIMER);
+            cancel_timer(LOSS_PROBE_TIMER);
+        }
+        else {
+            arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+        }
+        update_readiness(); // acknowledged data left the send buffer
+    }
+
+    // Header prediction (Van Jacobson; RFC 1323 appendix): in ESTABLISHED,
+    // a segment with only ACK/PSH set, the next expected sequence number,
+    // an unchanged window and no options beyond a timestamp is either a
+    // pure ACK of new data or in-order data. Such a segment only moves
+    // snd_una / ack_num; recovery, reassembly, SACK and window updates are
+    // left to the general path.
+    bool predicted_segment(const TCPSegment& segment) {
+        const TCPOptions& options = segment.options;
+        uint32_t seq = ntohl(segment.seq_num);
+        uint32_t ack = ntohl(segment.ack_num);
+        uint32_t length = static_cast<uint32_t>(segment.payload.size());
+
+        if (state != ESTABLISHED || (segment.flags & ~TCPSegment::PSH) != TCPSegment::ACK || seq != ack_num
+            || (static_cast<uint32_t>(ntohs(segment.window_size)) << snd_wscale) != snd_wnd
+            || options.sack_count != 0 || options.mss != 0 || options.has_window_scale || options.sack_permitted
+            || options.has_timestamp != ts_enabled || (ts_enabled && seq_before(options.ts_val, ts_recent))
+            || in_recovery || tlp_in_flight || reassembly
+            || seq_before(ack, snd_una) || seq_after(ack, seq_num)) {
+            return false;
+        }
+        if (length == 0) {
+            if (ack == snd_una) {
+                return false; // duplicate ACK
+            }
+        }
+        else if (length > receive_space()) {
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (ts_enabled) {
+            ts_recent = options.ts_val;
+        }
+        restart_keepalive();
+        snd_wl1 = seq; // the window is unchanged, but this segment is now the newest to carry it
+        snd_wl2 = ack;
+        bool new_ack = ack != snd_una;
+
+        if (new_ack) {
+            acknowledge(ack, ts_enabled ? options.ts_ecr : 0, false, now);
+        }
+        if (length > 0) {
+            deliver_in_order(segment.payload.data(), length);
+            fast_path_data++;
+
+        }
+        else {
+            fast_path_acks++;
+        }
+        if (new_ack) {
+            output(); // after the data, so new segments carry the latest ack_num
+        }
+        return true;
+    }
+
+    // Drops segments covered by a cumulative ACK, taking an RTT sample from the
+    // newest one that was not retransmitted (Karn) and updating RACK state.
+    // When every acked segment was retransmitted, the echoed timestamp
+    // `ts_ecr` (0 if none) still identifies the transmission and gives a sample.
+    void acknowledge_sent_segments(uint32_t ack, std::chrono::steady_clock::time_point now, uint32_t ts_ecr = 0) {
+        std::chrono::steady_clock::time_point sample_xmit_time;
+        bool have_sample = false;
+        bool acked_any = false;
+
+        while (!sent_segments.empty() && !seq_after(sent_segments.front().end_seq, ack)) {
+            const SentSegment& sent = sent_segments.front();
+            if (!sent.retransmitted && (!have_sample || sent.xmit_time > sample_xmit_time)) {
+                sample_xmit_time = sent.xmit_time;
+                have_sample = true;
+            }
+            if (!sent.sacked) {
+                rack_update(sent, now);
+            }
+            sent_segments.pop_front();
+            acked_any = true;
+        }
+
+        if (have_sample) {
+            auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - sample_xmit_time);
+            rtt_estimator.add_sample(rtt);
+            congestion_control->on_rtt_sample(rtt, now);
+        }
+        else if (acked_any && ts_ecr != 0) {
+            std::chrono::microseconds rtt = std::chrono::milliseconds(std::max<uint32_t>(timestamp_clock() - ts_ecr, 1));
+            rtt_estimator.add_sample(rtt);
+            congestion_control->on_rtt_sample(rtt, now);
+        }
+    }
+
+    // Marks segments wholly inside a SACK block as delivered; they count
+    // toward RACK's delivery time and are never retransmitted.
+    void mark_sacked(const TCPOptions::SackBlock& block, std::chrono::steady_clock::time_point now) {
+        if (!seq_after(block.right, block.left) || seq_before(block.left, snd_una) || seq_after(block.right, seq_num)) {
+            return;
+        }
+        for (size_t i = sent_segments.lower_bound(block.left); i < sent_segments.size() && !seq_after(sent_segments[i].end_seq, block.right); i++) {
+            if (!sent_segments[i].sacked) {
+                sent_segments.mark_sacked(i);
+                rack_update(sent_segments[i], now);
+            }
+        }
+    }
+
+    // Sender side of ECN: the controller sees every ACK, and an ECE reduces
+    // the window at most once per window of data (RFC 3168 6.1.2). A loss
+    // recovery in progress has already reduced it.
+    void receive_ecn_echo(uint32_t acked, bool ece, std::chrono::steady_clock::time_point now) {
+        congestion_control->on_ecn_ack(acked, ece, now);
+        if (in_cwr && !seq_before(snd_una, cwr_point)) {
+            in_cwr = false;
+        }
+        if (ece && !in_cwr && !in_recovery) {
+            congestion_control->on_ecn(bytes_in_flight(), now);
+            in_cwr = true;
+            cwr_point = seq_num;
+            cwr_pending = true;
+        }
+    }
+
+    // Receiver side: CE marks on arriving data are echoed in ECE. With DCTCP
+    // the echo follows the marks exactly, and a change of CE state first
+    // acknowledges the data before it with the old value (RFC 8257 3.2);
+    // otherwise ECE is latched until the sender's CWR (RFC 3168 6.1.3).
+    void receive_ecn(uint8_t flags, bool ce) {
+        if (!ecn_active) {
+            return;
+        }
+        if (congestion_algorithm == CongestionControl::DCTCP) {
+            if (ce != ecn_echo) {
+                if (rcv_unacked > 0) {
+                    send_pure_ack();
+                }
+                ecn_echo = ce;
+            }
+            return;
+        }
+        if (flags & TCPSegment::CWR) {
+            ecn_echo = false;
+        }
+        if (ce) {
+            ecn_echo = true;
+        }
+    }
+
+    uint8_t cwr_flag() {
+        if (!cwr_pending) {
+            return 0;
+        }
+        cwr_pending = false;
+        return TCPSegment::CWR;
+    }
+
+    // Applies the options of the peer's SYN or SYN-ACK. Window scaling, SACK
+    // and timestamps are used only when both sides offered them. A tiny
+    // advertised MSS is raised to MIN_PEER_MSS so a peer cannot make us cut
+    // the stream into a frame every few bytes.
+    void apply_syn_options(const TCPOptions& peer) {
+        if (peer.mss != 0 && peer.mss < mss) {
+            mss = std::max(peer.mss, MIN_PEER_MSS);
+            congestion_control = CongestionControl::create(congestion_algorithm, mss);
+        }
+        if (peer.has_window_scale) {
+            snd_wscale = peer.window_scale;
+        }
+        else {
+            snd_wscale = 0;
+            rcv_wscale = 0;
+        }
+        sack_enabled = peer.sack_permitted;
+        ts_enabled = peer.has_timestamp;
+        if (ts_enabled) {
+            ts_recent = peer.ts_val;
+        }
+    }
+
+    // Our SYN offers every option; a SYN-ACK (Fast Open) only those the peer's SYN offered.
+    TCPOptions syn_options() const {
+        TCPOptions options;
+        options.mss = DEFAULT_MSS;
+        bool reply = state == SYN_RECEIVED;
+        options.has_window_scale = !reply || rcv_wscale != 0;
+        options.window_scale = WINDOW_SCALE;
+        options.sack_permitted = !reply || sack_enabled;
+        options.has_timestamp = !reply || ts_enabled;
+        options.ts_val = timestamp_clock();
+        options.ts_ecr = ts_recent;
+        if (state == CLOSED && fast_open_cache) {
+            // Send the cached cookie, or an empty option to request one
+            options.fast_open = true;
+            const FastOpenCache::Entry* cookie = fast_open_cache->lookup(IPAddress(dest_ip));
+            if (cookie) {
+                options.fast_open_cookie_length = cookie->cookie_length;
+                memcpy(options.fast_open_cookie, cookie->cookie, cookie->cookie_length);
+            }
+        }
+        return options;
+    }
+
+    // Client side of Fast Open, on the SYN-ACK: takes acknowledged SYN data
+    // off the send buffer (the rest goes out again once established) and
+    // caches a cookie the server returned, with its MSS.
+    void receive_fast_open_reply(const TCPSegment& segment) {
+        uint32_t ack = ntohl(segment.ack_num);
+        if (syn_data > 0 && seq_after(ack, seq_num) && !seq_after(ack, seq_num + syn_data)) {
+            uint32_t acked = ack - seq_num;
+            send_buffer.consume(acked);
+            seq_num += acked;
+            snd_una = seq_num;
+        }
+        syn_data = 0;
+        if (fast_open_cache && segment.options.fast_open && segment.options.fast_open_cookie_length != 0) {
+            uint16_t peer_mss = segment.options.mss != 0 ? segment.options.mss : static_cast<uint16_t>(MIN_RCV_MSS);
+            fast_open_cache->store(IPAddress(dest_ip), segment.options.fast_open_cookie, segment.options.fast_open_cookie_length, peer_mss);
+        }
+    }
+
+    // RFC 7323 4.3: remember the peer's timestamp from segments at or before
+    // the left edge of the window, for echoing in our segments.
+    void update_ts_recent(const TCPSegment& segment) {
+        if (ts_enabled && segment.options.has_timestamp && !seq_after(ntohl(segment.seq_num), ack_num)
+            && !seq_before(segment.options.ts_val, ts_recent)) {
+            ts_recent = segment.options.ts_val;
+        }
+    }
+
+    // RFC 793 3.9: the window is taken only from an acceptable ACK on a
+    // segment no older than the one that last set it, so a reordered old
+    // ACK cannot shrink or reopen it.
+    void update_send_window(const TCPSegment& segment, uint32_t ack) {
+        uint32_t seq = ntohl(segment.seq_num);
+        if (seq_before(ack, snd_una) || seq_after(ack, seq_num)) {
+            return;
+        }
+        if (seq_before(snd_wl1, seq) || (snd_wl1 == seq && !seq_after(snd_wl2, ack))) {
+            snd_wnd = static_cast<uint32_t>(ntohs(segment.window_size)) << snd_wscale;
+            snd_wl1 = seq;
+            snd_wl2 = ack;
+        }
+    }
+
+    uint32_t echoed_timestamp(const TCPSegment& segment) const {
+        return ts_enabled && segment.options.has_timestamp ? segment.options.ts_ecr : 0;
+    }
+
+    uint32_t receive_space() const {
+        size_t buffered = receive_buffer.size() + (reassembly ? reassembly->bytes : 0);
+        return buffered < RECEIVE_BUFFER_SIZE ? static_cast<uint32_t>(RECEIVE_BUFFER_SIZE - buffered) : 0;
+    }
+
+    uint16_t advertised_window(bool syn) const {
+        uint32_t window = syn ? receive_space() : receive_space() >> rcv_wscale;
+        return static_cast<uint16_t>(std::min<uint32_t>(window, 65535));
+    }
+
+    // Reports held out-of-order data, the most recently received block first (RFC 2018 4).
+    void fill_sack_blocks(TCPOptions& options) const {
+        options.sack_count = 0;
+        if (!reassembly) {
+            return;
+        }
+
+        std::vector<TCPOptions::SackBlock> blocks;
+        for (const auto& entry : reassembly->segments) {
+            uint32_t end = entry.first + static_cast<uint32_t>(entry.second.size());
+            if (!blocks.empty() && !seq_before(blocks.back().right, entry.first)) {
+                if (seq_after(end, blocks.back().right)) {
+                    blocks.back().right = end;
+                }
+            }
+            else {
+                blocks.push_back({ entry.first, end });
+            }
+        }
+
+        for (const auto& block : blocks) {
+            if (!seq_before(reassembly->last_seq, block.left) && seq_before(reassembly->last_seq, block.right)) {
+                options.sack_blocks[options.sack_count++] = block;
+                break;
+            }
+        }
+        for (const auto& block : blocks) {
+            if (options.sack_count >= options.max_sack_blocks()) {
+                break;
+            }
+            if (options.sack_count == 0 || block.left != options.sack_blocks[0].left) {
+                options.sack_blocks[options.sack_count++] = block;
+            }
+        }
+    }
+
+    static bool rack_sent_after(std::chrono::steady_clock::time_point t1, uint32_t end1, std::chrono::steady_clock::time_point t2, uint32_t end2) {
+        return t1 > t2 || (t1 == t2 && seq_after(end1, end2));
+    }
+
+    void rack_update(const SentSegment& sent, std::chrono::steady_clock::time_point now) {
+        auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - sent.xmit_time);
+        // An ACK for a retransmission faster than min_rtt most likely acks the original
+        if (sent.retransmitted && rtt < rtt_estimator.min_rtt()) {
+            return;
+        }
+        if (rack_sent_after(sent.xmit_time, sent.end_seq, rack_xmit_time, rack_end_seq)) {
+            rack_rtt = rtt;
+            rack_xmit_time = sent.xmit_time;
+            rack_end_seq = sent.end_seq;
+        }
+    }
+
+    // RACK (RFC 8985 6.2): a segment is lost once a segment sent later has
+    // been delivered and a reordering window has elapsed since it was sent.
+    // Segments are walked in transmission order, so the walk stops at the
+    // first one sent after RACK's segment or still inside its window; lost
+    // and SACKed segments are off the list. Returns the time until the next
+    // segment could be declared lost.
+    std::chrono::microseconds rack_detect_loss(std::chrono::steady_clock::time_point now) {
+        std::chrono::microseconds reo_wnd = in_recovery ? std::chrono::microseconds(0) : rtt_estimator.min_rtt() / 4;
+        std::chrono::microseconds timeout(0);
+        if (!sack_enabled) {
+            // RACK needs SACK (RFC 8985 4): from cumulative ACKs alone, the ACK of a
+            // retransmission would mark everything sent before it lost
+            return timeout;
+        }
+
+        size_t i = sent_segments.oldest_in_flight();
+        while (i < sent_segments.size()) {
+            const SentSegment& sent = sent_segments[i];
+            if (!rack_sent_after(rack_xmit_time, rack_end_seq, sent.xmit_time, sent.end_seq)) {
+                break;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(sent.xmit_time + rack_rtt + reo_wnd - now);
+            if (remaining.count() > 0) {
+                timeout = remaining;
+                break;
+            }
+            size_t next = sent_segments.next_in_flight(i);
+            sent_segments.mark_lost(i);
+            i = next;
+        }
+        return timeout;
+    }
+
+    void detect_and_recover_losses(std::chrono::steady_clock::time_point now) {
+        std::chrono::microseconds timeout = rack_detect_loss(now);
+        if (timeout.count() > 0) {
+            arm_timer(REORDER_TIMER, timeout);
+        }
+        else {
+            cancel_timer(REORDER_TIMER);
+        }
+
+        if (sent_segments.lost_count() == 0) {
+            return;
+        }
+        uint32_t pipe = sent_segments.pipe();
+
+        // The first retransmission of a recovery goes out whatever the pipe
+        // (RFC 5681 3.2 step 2, RFC 6675 5 step 4.3); without SACK the pipe
+        // still counts the segments the duplicate ACKs reported delivered.
+        bool first = !in_recovery;
+        if (!in_recovery) {
+            in_recovery = true;
+            recovery_point = seq_num;
+            congestion_control->on_loss(bytes_in_flight(), now);
+        }
+
+        // Retransmit lost segments in sequence order while the window allows
+        uint32_t window = std::max<uint32_t>(congestion_control->cwnd(), mss);
+        for (size_t i = sent_segments.first_lost(); i < sent_segments.size() && (pipe < window || first); i = sent_segments.first_lost()) {
+            retransmit_segment(i, now);
+            pipe += sent_segments[i].end_seq - sent_segments[i].seq;
+            first = false;
+            log("Retransmitting lost segment with seq_num: " + std::to_string(sent_segments[i].seq));
+        }
+
+
+    }
+
+    // Tail loss probe (RFC 8985 7.2): if no ACK arrives within ~2 SRTT, send
+    // one segment to elicit an ACK so a tail drop is repaired by RACK or the
+    // probe itself instead of waiting for the RTO.
+    void schedule_loss_probe() {
+        if (sent_segments.empty() || tlp_in_flight || in_recovery) {
+            cancel_timer(LOSS_PROBE_TIMER);
+            return;
+        }
+
+        std::chrono::microseconds pto = std::chrono::seconds(1);
+        if (rtt_estimator.has_sample()) {
+            pto = rtt_estimator.srtt() * 2;
+            if (bytes_in_flight() <= mss) {
+                pto += WORST_CASE_ACK_DELAY;
+            }
+            pto += std::chrono::microseconds(2000);
+        }
+        if (pto >= rtt_estimator.rto()) {
+            cancel_timer(LOSS_PROBE_TIMER); // the RTO fires first anyway
+            return;
+        }
+        arm_timer(LOSS_PROBE_TIMER, pto);
+    }
+
+    void handle_loss_probe() {
+        if (sent_segments.empty()) {
+            return;
+        }
+
+        size_t offset = seq_num - snd_una;
+        if (offset < send_buffer.size() && bytes_in_flight() < std::min(congestion_control->cwnd(), snd_wnd)) {
+            size_t length = std::min<size_t>(mss, send_buffer.size() - offset);
+            send_data(seq_num, offset, length);
+            seq_num += static_cast<uint32_t>(length);
+        }
+        else {
+            retransmit_last_segment();
+        }
+
+        log("Sent tail loss probe");
+        tlp_in_flight = true;
+        tlp_end_seq = seq_num;
+        arm_timer(RETRANSMIT_TIMER, rtt_estimator.rto());
+    }
+
+    // Paced with earliest departure times when the link has a pacing queue.
+    void send_ethernet_burst(const std::vector<std::vector<uint8_t>>& frames) {
+        if (pacing()) {
+            for (const auto& frame : frames) {
+                link->transmit_at(frame, departure_time(frame.size()));
+            }
+            return;
+        }
+        if (link) {
+            link->transmit_burst(frames);
+            return;
+        }
+        for (const auto& frame : frames) {
+            send_ethernet_frame(frame);
+        }
+    }
+
+    bool pacing() const {
+        return link && link->supports_pacing() && congestion_control->pacing_rate() != 0;
+    }
+
+    // Earliest departure time (EDT) for a data frame of `length` bytes: frames
+    // are spaced at the congestion controller's pacing rate, and an idle
+    // connection earns no credit for a burst later.
+    std::chrono::steady_clock::time_point departure_time(size_t length) {
+        auto now = std::chrono::steady_clock::now();
+        auto departure = std::max(now, pacing_time);
+        uint64_t rate = congestion_control->pacing_rate();
+        pacing_time = departure + std::chrono::nanoseconds(static_cast<int64_t>(length * 1000000000ULL / rate));
+        return departure;
+    }
 
     void send_ethernet_frame(const std::vector<uint8_t>& frame) {
+        if (link) {
+            link->transmit(frame);
+            return;
+        }
 #ifdef _WIN32
         SOCKET sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
         if (sockfd == INVALID_SOCKET) {
@@ -237,7 +1718,7 @@ private:
             return;
         }
 
-        struct sockaddr_ll dest_addr = { 0 };
+        struct sockaddr_ll dest_addr = {};
         dest_addr.sll_ifindex = if_nametoindex("eth0");
         dest_addr.sll_protocol = htons(ETH_P_IP);
         dest_addr.sll_halen = ETH_ALEN;
@@ -0,0 +1,420 @@
+#ifndef TCPLISTENER_H
+#define TCPLISTENER_H
+
+#include "TCP.h"
+#include "IP.h"
+#include "Ethernet.h"
+#include "Link.h"
+#include "SipHash.h"
+#include "TimerWheel.h"
+#include "TCPConnection.h"
+#include "ConnectionTable.h"
+#include "EventPoller.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+// Passive open on one local port. Each SYN creates a small HalfOpen record
+// in a bounded SYN queue (no TCPConnection, no buffers); the final ACK
+// promotes it to a TCPConnection on the accept queue. While the SYN queue is
+// full the listener answers with SYN cookies (RFC 4987 3.6) and keeps no
+// state until a valid ACK arrives, so memory stays flat under a SYN flood.
+// A cookie only encodes the MSS, so cookie connections run without window
+// scaling, SACK, timestamps and ECN.
+//
+// With Fast Open enabled (RFC 7413) the SYN-ACK hands out a cookie to
+// clients that ask; a later SYN carrying a valid cookie and data skips the
+// SYN queue and goes straight to the accept queue with its data readable.
+class TCPListener {
+public:
+    typedef ConnectionTable<TCPConnection, TCPListener> Table;
+
+    // local_ip 0 listens on every address. Without `timers` SYN-ACKs are
+    // not retransmitted, and half-open entries are aged out when a SYN
+    // finds the SYN queue full.
+    TCPListener(uint32_t local_ip, uint16_t local_port, Link& link, TimerWheel* timers = nullptr, size_t backlog = 128, size_t max_syn_queue = 1024)
+        : local_ip(local_ip),
+        local_port(local_port),
+        link(link),
+        timer_wheel(timers),
+        connection_table(nullptr),
+        congestion_algorithm(CongestionControl::NEW_RENO),
+        backlog(backlog),
+        max_syn_queue(max_syn_queue),
+        max_fast_open_pending(0),
+        syn_cookies_sent(0),
+        syn_cookies_accepted(0),
+        fast_open_accepted(0),
+        start_time(std::chrono::steady_clock::now()),
+        next_syn_queue_sweep(start_time) {}
+
+    TCPListener(const TCPListener&) = delete;
+    TCPListener& operator=(const TCPListener&) = delete;
+
+    // Accepted connections are registered here so later segments demux to
+    // them; each removes itself when destroyed.
+    void set_connection_table(Table* table) {
+        connection_table = table;
+    }
+
+    // Congestion controller for accepted connections; DCTCP also makes them
+    // echo CE marks exactly.
+    void set_congestion_control(CongestionControl::Algorithm algorithm) {
+        congestion_algorithm = algorithm;
+    }
+
+    // Accepts data in SYNs with a valid Fast Open cookie while fewer than
+    // `max_pending` such connections wait in the accept queue still in
+    // SYN_RECEIVED (RFC 7413 4.2.2); 0 turns Fast Open off.
+    void enable_fast_open(size_t max_pending = 64) {
+        max_fast_open_pending = max_pending;
+    }
+
+    // Handles a segment from (src_ip, port) to (dest_ip, port) that matched no connection.
+    void receive_segment(uint32_t src_ip, uint32_t dest_ip, const TCPSegment& segment) {
+        uint16_t remote_port = ntohs(segment.src_port);
+        FlowKey key(dest_ip, local_port, src_ip, remote_port);
+
+        if (segment.flags & TCPSegment::RST) {
+            syn_queue.erase(key);
+            return;
+        }
+
+        if ((segment.flags & TCPSegment::SYN) && !(segment.flags & TCPSegment::ACK)) {
+            receive_syn(key, segment);
+        }
+        else if ((segment.flags & TCPSegment::ACK) && !(segment.flags & TCPSegment::SYN)) {
+            receive_ack(key, segment);
+        }
+    }
+
+    // Returns the next fully established connection, or nullptr.
+    std::unique_ptr<TCPConnection> accept() {
+        if (accept_queue.empty()) {
+            return nullptr;
+        }
+        std::unique_ptr<TCPConnection> connection = std::move(accept_queue.front());
+        accept_queue.pop_front();
+        update_readiness();
+        return connection;
+    }
+
+    size_t syn_queue_length() const {
+        return syn_queue.size();
+    }
+
+    size_t accept_queue_length() const {
+        return accept_queue.size();
+    }
+
+    bool syn_cookies_active() const {
+        return syn_queue.size() >= max_syn_queue;
+    }
+
+    uint64_t get_syn_cookies_sent() const {
+        return syn_cookies_sent;
+    }
+
+    uint64_t get_syn_cookies_accepted() const {
+        return syn_cookies_accepted;
+    }
+
+    uint64_t get_fast_open_accepted() const {
+        return fast_open_accepted;
+    }
+
+    uint32_t get_local_ip() const {
+        return local_ip;
+    }
+
+    uint16_t get_local_port() const {
+        return local_port;
+    }
+
+    // ACCEPTABLE while the accept queue is not empty.
+    EventPoller::Source& get_poll_source() {
+        return readiness;
+    }
+
+private:
+    struct HalfOpen {
+        uint32_t iss;
+        uint32_t irs;
+        TCPOptions peer_options;
+        bool ecn; // the SYN asked for ECN (RFC 3168 6.1.1) and we agreed
+        uint32_t retries;
+        std::chrono::steady_clock::time_point created;
+        TimerWheel::Timer timer;
+    };
+
+    struct KeyHash {
+        size_t operator()(const FlowKey& key) const {
+            return static_cast<size_t>(FlowKeyHash()(key, 0));
+        }
+    };
+
+    static const uint32_t MAX_SYNACK_RETRIES = 5;
+    static constexpr std::chrono::seconds HALF_OPEN_LIFETIME{ 63 }; // the SYN-ACK timer gives up after 1 + 2 + ... + 32 s
+    static constexpr std::chrono::seconds COOKIE_PERIOD{ 64 };
+    static const uint16_t DEFAULT_PEER_MSS = 536; // RFC 1122 4.2.2.6
+    static constexpr uint8_t FAST_OPEN_COOKIE_LENGTH = 8;
+    static constexpr uint16_t COOKIE_MSS_TABLE[8] = { 536, 1024, 1220, 1360, 1400, 1440, 1452, 1460 };
+
+    uint32_t local_ip;
+    uint16_t local_port;
+    Link& link;
+    TimerWheel* timer_wheel;
+    Table* connection_table;
+    CongestionControl::Algorithm congestion_algorithm;
+    size_t backlog;
+    size_t max_syn_queue;
+    size_t max_fast_open_pending;
+    uint64_t syn_cookies_sent;
+    uint64_t syn_cookies_accepted;
+    uint64_t fast_open_accepted;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point next_syn_queue_sweep;
+    SipHash isn_hash;
+    SipHash cookie_hash;
+    SipHash fast_open_hash;
+    std::unordered_map<FlowKey, std::unique_ptr<HalfOpen>, KeyHash> syn_queue;
+    std::deque<std::unique_ptr<TCPConnection>> accept_queue;
+    EventPoller::Source readiness;
+    uint8_t dest_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint8_t src_mac[6] = { 0x00, 0x0c, 0x29, 0x36, 0xbc, 0x17 };
+
+    void receive_syn(const FlowKey& key, const TCPSegment& segment) {
+        uint32_t irs = ntohl(segment.seq_num);
+
+        auto existing = syn_queue.find(key);
+        if (existing != syn_queue.end()) {
+            // Retransmitted SYN: repeat our SYN-ACK
+            send_syn_ack(key, existing->second->iss, existing->second->irs, existing->second->peer_options, existing->second->ecn);
+            return;
+        }
+
+        if (segment.options.fast_open && !segment.payload.empty() && fast_open_cookie_valid(key, segment.options)
+            && accept_queue.size() < backlog && fast_open_pending() < max_fast_open_pending) {
+            accept_fast_open(key, segment);
+            return;
+        }
+
+        if (!timer_wheel && syn_queue.size() >= max_syn_queue) {
+            expire_half_open();
+        }
+
+        if (accept_queue.size() >= backlog || syn_queue.size() >= max_syn_queue) {
+            TCPOptions cookie_options;
+            cookie_options.mss = segment.options.mss != 0 ? segment.options.mss : DEFAULT_PEER_MSS;
+            uint32_t cookie = make_cookie(key, irs, cookie_options.mss);
+            send_syn_ack(key, cookie, irs, cookie_options, false);
+            syn_cookies_sent++;
+            return;
+        }
+
+        std::unique_ptr<HalfOpen> half_open(new HalfOpen());
+        half_open->iss = generate_isn(key);
+        half_open->irs = irs;
+        half_open->peer_options = segment.options;
+        half_open->peer_options.sack_count = 0;
+        half_open->ecn = ecn_setup(segment);
+        half_open->retries = 0;
+        half_open->created = std::chrono::steady_clock::now();
+        HalfOpen* entry = half_open.get();
+        entry->timer.set_callback([this, key, entry] { handle_synack_timeout(key, *entry); });
+        syn_queue[key] = std::move(half_open);
+
+        send_syn_ack(key, entry->iss, irs, entry->peer_options, entry->ecn);
+        if (timer_wheel) {
+            timer_wheel->schedule(entry->timer, std::chrono::seconds(1));
+        }
+    }
+
+    void receive_ack(const FlowKey& key, const TCPSegment& segment) {
+        uint32_t ack = ntohl(segment.ack_num);
+        uint32_t irs = ntohl(segment.seq_num) - 1;
+
+        auto it = syn_queue.find(key);
+        if (it != syn_queue.end()) {
+            if (ack != it->second->iss + 1 || accept_queue.size() >= backlog) {
+                return;
+            }
+            HalfOpen& entry = *it->second;
+            promote(key, entry.iss, entry.irs, entry.peer_options, entry.ecn, segment);
+            syn_queue.erase(it);
+            return;
+        }
+
+        TCPOptions cookie_options;
+        if (accept_queue.size() < backlog && check_cookie(key, irs, ack - 1, cookie_options.mss)) {
+            syn_cookies_accepted++;
+            promote(key, ack - 1, irs, cookie_options, false, segment);
+        }
+    }
+
+    void promote(const FlowKey& key, uint32_t iss, uint32_t irs, const TCPOptions& peer_options, bool ecn, const TCPSegment& segment) {
+        std::unique_ptr<TCPConnection> connection = create_connection(key);
+        connection->establish_passive(iss, irs, peer_options, ecn);
+        if (!segment.payload.empty()) {
+            connection->receive_data(segment);
+        }
+        enqueue(std::move(connection));
+    }
+
+    // The connection sends its own SYN-ACK and retransmits it until acknowledged.
+    void accept_fast_open(const FlowKey& key, const TCPSegment& segment) {
+        std::unique_ptr<TCPConnection> connection = create_connection(key);
+        connection->accept_fast_open(generate_isn(key), segment, ecn_setup(segment));
+        fast_open_accepted++;
+        enqueue(std::move(connection));
+    }
+
+    std::unique_ptr<TCPConnection> create_connection(const FlowKey& key) {
+        std::unique_ptr<TCPConnection> connection(new TCPConnection(key.local_port, key.remote_port, key.local_ip, key.remote_ip, timer_wheel));
+        connection->set_link(&link);
+        connection->set_congestion_control(congestion_algorithm);
+        return connection;
+    }
+
+    void enqueue(std::unique_ptr<TCPConnection> connection) {
+        if (connection_table) {
+            connection->add_to_table(*connection_table);
+        }
+        accept_queue.push_back(std::move(connection));
+        update_readiness();
+    }
+
+    void update_readiness() {
+        readiness.set_events(accept_queue.empty() ? 0 : EventPoller::ACCEPTABLE);
+    }
+
+    size_t fast_open_pending() const {
+        size_t pending = 0;
+        for (const auto& connection : accept_queue) {
+            if (connection->get_state() == TCPConnection::SYN_RECEIVED) {
+                pending++;
+            }
+        }
+        return pending;
+    }
+
+    static bool ecn_setup(const TCPSegment& syn) {
+        return (syn.flags & (TCPSegment::ECE | TCPSegment::CWR)) == (TCPSegment::ECE | TCPSegment::CWR);
+    }
+
+    void handle_synack_timeout(FlowKey key, HalfOpen& entry) {
+        if (++entry.retries > MAX_SYNACK_RETRIES) {
+            syn_queue.erase(key); // destroys this timer's callback; nothing is touched afterwards
+            return;
+        }
+        send_syn_ack(key, entry.iss, entry.irs, entry.peer_options, entry.ecn);
+        timer_wheel->schedule(entry.timer, std::chrono::seconds(1 << entry.retries));
+    }
+
+    // Without timers nothing else removes entries whose final ACK never
+    // came; drop those past the time the SYN-ACK timer would have kept them.
+    // At most one sweep per second, so a flood does not make every SYN scan
+    // the whole queue.
+    void expire_half_open() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now < next_syn_queue_sweep) {
+            return;
+        }
+        next_syn_queue_sweep = now + std::chrono::seconds(1);
+        for (auto it = syn_queue.begin(); it != syn_queue.end(); ) {
+            if (now - it->second->created >= HALF_OPEN_LIFETIME) {
+                it = syn_queue.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    // Answers with our MSS and each option the peer offered; an ECN-setup
+    // SYN-ACK carries ECE without CWR. A Fast Open option in the SYN, a
+    // request or a cookie we did not accept, is answered with a fresh cookie.
+    void send_syn_ack(const FlowKey& key, uint32_t iss, uint32_t irs, const TCPOptions& peer_options, bool ecn) {
+        uint8_t flags = TCPSegment::SYN | TCPSegment::ACK | (ecn ? TCPSegment::ECE : 0);
+        TCPSegment syn_ack_segment(key.local_port, key.remote_port, iss, irs + 1, {}, flags);
+        syn_ack_segment.window_size = htons(static_cast<uint16_t>(std::min<uint32_t>(TCPConnection::RECEIVE_BUFFER_SIZE, 65535)));
+        syn_ack_segment.options.mss = TCPConnection::DEFAULT_MSS;
+        if (peer_options.has_window_scale) {
+            syn_ack_segment.options.has_window_scale = true;
+            syn_ack_segment.options.window_scale = TCPConnection::WINDOW_SCALE;
+        }
+        syn_ack_segment.options.sack_permitted = peer_options.sack_permitted;
+        if (peer_options.has_timestamp) {
+            syn_ack_segment.options.has_timestamp = true;
+            syn_ack_segment.options.ts_val = TCPConnection::timestamp_clock();
+            syn_ack_segment.options.ts_ecr = peer_options.ts_val;
+        }
+        if (peer_options.fast_open && max_fast_open_pending != 0) {
+            syn_ack_segment.options.fast_open = true;
+            syn_ack_segment.options.fast_open_cookie_length = FAST_OPEN_COOKIE_LENGTH;
+            make_fast_open_cookie(key, syn_ack_segment.options.fast_open_cookie);
+        }
+        IPPacket ip_syn_ack_packet(IPPROTO_TCP, key.local_ip, key.remote_ip, syn_ack_segment.serialize(key.local_ip, key.remote_ip));
+        EthernetFrame ethernet_syn_ack_frame(dest_mac, src_mac, 0x0800, ip_syn_ack_packet.serialize());
+        link.transmit(ethernet_syn_ack_frame.serialize());
+    }
+
+    // RFC 6528: ISN = M + F(4-tuple, secret), M a 4 microsecond clock.
+    uint32_t generate_isn(const FlowKey& key) const {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+        return static_cast<uint32_t>(isn_hash.hash(&key, sizeof(key))) + static_cast<uint32_t>(elapsed.count() / 4);
+    }
+
+    // RFC 7413 4.1.2: a MAC of the client address under a server secret
+    void make_fast_open_cookie(const FlowKey& key, uint8_t* cookie) const {
+        uint64_t mac = fast_open_hash.hash(&key.remote_ip, sizeof(key.remote_ip));
+        memcpy(cookie, &mac, FAST_OPEN_COOKIE_LENGTH);
+    }
+
+    bool fast_open_cookie_valid(const FlowKey& key, const TCPOptions& options) const {
+        if (max_fast_open_pending == 0 || options.fast_open_cookie_length != FAST_OPEN_COOKIE_LENGTH) {
+            return false;
+        }
+        uint8_t expected[FAST_OPEN_COOKIE_LENGTH];
+        make_fast_open_cookie(key, expected);
+        return memcmp(expected, options.fast_open_cookie, FAST_OPEN_COOKIE_LENGTH) == 0;
+    }
+
+    uint32_t cookie_counter() const {
+        return static_cast<uint32_t>((std::chrono::steady_clock::now() - start_time) / COOKIE_PERIOD);
+    }
+
+    uint32_t cookie_mac(const FlowKey& key, uint32_t irs, uint32_t counter) const {
+        uint32_t input[5] = { key.local_ip, key.remote_ip, (static_cast<uint32_t>(key.local_port) << 16) | key.remote_port, irs, counter };
+        return static_cast<uint32_t>(cookie_hash.hash(input, sizeof(input))) & 0x00FFFFFF;
+    }
+
+    // Cookie layout: 5 bits of time counter | 3 bits of MSS index | 24-bit MAC.
+    uint32_t make_cookie(const FlowKey& key, uint32_t irs, uint16_t peer_mss) const {
+        uint32_t mss_index = 0;
+        for (uint32_t i = 0; i < 8; i++) {
+            if (COOKIE_MSS_TABLE[i] <= peer_mss) {
+                mss_index = i;
+            }
+        }
+        uint32_t counter = cookie_counter();
+        return ((counter & 0x1F) << 27) | (mss_index << 24) | cookie_mac(key, irs, counter);
+    }
+
+    // Accepts cookies from the current and previous period (up to 128 s old).
+    bool check_cookie(const FlowKey& key, uint32_t irs, uint32_t cookie, uint16_t& peer_mss) const {
+        uint32_t now = cookie_counter();
+        uint32_t age = (now - (cookie >> 27)) & 0x1F;
+        if (age > 1 || now < age) {
+            return false;
+        }
+        if (cookie_mac(key, irs, now - age) != (cookie & 0x00FFFFFF)) {
+            return false;
+        }
+        peer_mss = COOKIE_MSS_TABLE[(cookie >> 24) & 0x7];
+        return true;
+    }
+};
+
+#endif // TCPLISTENER_H
@@ -0,0 +1,201 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <utility>
+
+// Free lists of coroutine frames in 64-byte size classes. A frame freed when
+// a coroutine finishes is reused by the next one of similar size, so a
+// server that starts a coroutine per connection stops allocating once the
+// pool has warmed up. Frames above MAX_FRAME go to the global heap. One
+// pool per thread, like the stack itself; memory is kept until thread exit.
+class FramePool {
+public:
+    static constexpr size_t GRANULARITY = 64;
+    static constexpr size_t MAX_FRAME = 4096;
+
+    FramePool() : allocations(0), reused(0) {
+        for (auto& list : free_lists) {
+            list = nullptr;
+        }
+    }
+
+    ~FramePool() {
+        for (auto& list : free_lists) {
+            while (list) {
+                FreeFrame* frame = list;
+                list = frame->next;
+                ::operator delete(frame);
+            }
+        }
+    }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    static FramePool& instance() {
+        static thread_local FramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size) {
+        allocations++;
+        if (size > MAX_FRAME) {
+            return ::operator new(size);
+        }
+        FreeFrame*& list = free_lists[size_class(size)];
+        if (list) {
+            FreeFrame* frame = list;
+            list = frame->next;
+            reused++;
+            return frame;
+        }
+        return ::operator new((size_class(size) + 1) * GRANULARITY);
+    }
+
+    void deallocate(void* pointer, size_t size) {
+        if (size > MAX_FRAME) {
+            ::operator delete(pointer);
+            return;
+        }
+        FreeFrame* frame = static_cast<FreeFrame*>(pointer);
+        frame->next = free_lists[size_class(size)];
+        free_lists[size_class(size)] = frame;
+    }
+
+    uint64_t get_allocations() const {
+        return allocations;
+    }
+
+    // Allocations served from a free list
+    uint64_t get_reused() const {
+        return reused;
+    }
+
+private:
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    FreeFrame* free_lists[MAX_FRAME / GRANULARITY];
+    uint64_t allocations;
+    uint64_t reused;
+
+    static size_t size_class(size_t size) {
+        return size == 0 ? 0 : (size - 1) / GRANULARITY;
+    }
+};
+
+// Coroutine for stack I/O, with frames from the FramePool. A Task starts
+// suspended: either co_await it from another task, which resumes the caller
+// when it finishes, or hand it to EventLoop::spawn() to run detached, in
+// which case its frame is freed when it returns.
+class Task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        bool detached = false;
+
+        static void* operator new(size_t size) {
+            return FramePool::instance().allocate(size);
+        }
+
+        static void operator delete(void* pointer, size_t size) {
+            FramePool::instance().deallocate(pointer, size);
+        }
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            // Symmetric transfer to the awaiting task, so chains of tasks do not grow the stack
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                promise_type& promise = handle.promise();
+                std::coroutine_handle<> next = promise.continuation ? promise.continuation : std::noop_coroutine();
+                if (promise.detached) {
+                    handle.destroy();
+                }
+                return next;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    Task() : handle(nullptr) {}
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        reset();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    bool await_ready() const noexcept {
+        return done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+
+    void await_resume() noexcept {}
+
+    // Gives up ownership: the coroutine runs on and frees itself when it returns.
+    std::coroutine_handle<promise_type> detach() {
+        handle.promise().detached = true;
+        return std::exchange(handle, nullptr);
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+};
+
+#endif // TASK_H
@@ -0,0 +1,226 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <functional>
+
+// Hierarchical timing wheel (Varghese & Lauck). 4 levels of 64 slots give a
+// range of 64^4 ticks (~4.6 hours at the default 1 ms tick); later deadlines
+// are parked in the last level and cascaded down. Arm and cancel are O(1),
+// expiry is O(1) amortized per timer.
+//
+// Timers are intrusive: the owner embeds a TimerWheel::Timer and the wheel
+// links it into a slot list, so arming never allocates.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Timer {
+    public:
+        Timer() : next(nullptr), pprev(nullptr), expires(0), wheel(nullptr) {}
+        explicit Timer(std::function<void()> cb) : Timer() {
+            callback = std::move(cb);
+        }
+        ~Timer() {
+            cancel();
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void set_callback(std::function<void()> cb) {
+            callback = std::move(cb);
+        }
+
+        bool is_armed() const {
+            return wheel != nullptr;
+        }
+
+        void cancel() {
+            if (wheel) {
+                wheel->unlink(this);
+            }
+        }
+
+    private:
+        friend class TimerWheel;
+        Timer* next;
+        Timer** pprev;
+        uint64_t expires;
+        TimerWheel* wheel;
+        std::function<void()> callback;
+    };
+
+    explicit TimerWheel(std::chrono::microseconds tick = std::chrono::milliseconds(1), Clock::time_point start = Clock::now())
+        : tick_length(tick), start_time(start), current_tick(0), armed_count(0) {
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                slot = nullptr;
+            }
+        }
+    }
+
+    ~TimerWheel() {
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                while (slot) {
+                    unlink(slot);
+                }
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re)arms the timer to fire once `delay` from the wheel's current time.
+    void schedule(Timer& timer, Clock::duration delay) {
+        uint64_t ticks = static_cast<uint64_t>((delay + tick_length - Clock::duration(1)) / tick_length);
+        schedule_tick(timer, current_tick + ticks);
+    }
+
+    void schedule_at(Timer& timer, Clock::time_point when) {
+        if (when <= start_time) {
+            schedule_tick(timer, current_tick);
+            return;
+        }
+        // Round up so a timer never fires before its deadline
+        uint64_t ticks = static_cast<uint64_t>((when - start_time + tick_length - Clock::duration(1)) / tick_length);
+        schedule_tick(timer, ticks);
+    }
+
+    // Runs every timer whose deadline is at or before `now`. Callbacks may
+    // re-arm or cancel any timer, including the one being fired.
+    size_t advance(Clock::time_point now) {
+        if (now < start_time) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>((now - start_time) / tick_length) + 1;
+        size_t fired = 0;
+
+        while (current_tick < target) {
+            if (armed_count == 0) {
+                current_tick = target;
+                break;
+            }
+
+            size_t index = current_tick & SLOT_MASK;
+            if (index == 0) {
+                cascade();
+            }
+
+            Timer* list = slots[0][index];
+            if (list) {
+                list->pprev = &list;
+            }
+            slots[0][index] = nullptr;
+            current_tick++;
+
+            while (list) {
+                Timer* timer = list;
+                unlink(timer);
+                fired++;
+                if (timer->callback) {
+                    timer->callback();
+                }
+            }
+        }
+
+        return fired;
+    }
+
+    Clock::time_point now() const {
+        return start_time + std::chrono::duration_cast<Clock::duration>(tick_length * current_tick);
+    }
+
+    std::chrono::microseconds tick() const {
+        return tick_length;
+    }
+
+    size_t size() const {
+        return armed_count;
+    }
+
+    bool empty() const {
+        return armed_count == 0;
+    }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const uint64_t SLOTS = 1 << SLOT_BITS;
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+
+    std::chrono::microseconds tick_length;
+    Clock::time_point start_time;
+    uint64_t current_tick; // next tick to be processed
+    size_t armed_count;
+    Timer* slots[LEVELS][SLOTS];
+
+    void schedule_tick(Timer& timer, uint64_t expires) {
+        timer.cancel();
+        timer.expires = expires < current_tick ? current_tick : expires;
+        link(&timer);
+    }
+
+    void link(Timer* timer) {
+        uint64_t delta = timer->expires - current_tick;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (SLOTS << (level * SLOT_BITS))) {
+            level++;
+        }
+
+        uint64_t expires = timer->expires;
+        if (level == LEVELS - 1 && delta >= (SLOTS << (level * SLOT_BITS))) {
+            // Beyond the wheel's range: park at the furthest slot and re-cascade later
+            expires = current_tick + (SLOTS << (level * SLOT_BITS)) - 1;
+        }
+
+        Timer*& head = slots[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK];
+        timer->next = head;
+        if (head) {
+            head->pprev = &timer->next;
+        }
+        head = timer;
+        timer->pprev = &head;
+        timer->wheel = this;
+        armed_count++;
+    }
+
+    void unlink(Timer* timer) {
+        *timer->pprev = timer->next;
+        if (timer->next) {
+            timer->next->pprev = timer->pprev;
+        }
+        timer->next = nullptr;
+        timer->pprev = nullptr;
+        timer->wheel = nullptr;
+        armed_count--;
+    }
+
+    // Moves the timers of the next higher-level slot down the hierarchy.
+    void cascade() {
+        for (int level = 1; level < LEVELS; level++) {
+            size_t index = (current_tick >> (level * SLOT_BITS)) & SLOT_MASK;
+            Timer* list = slots[level][index];
+            if (list) {
+                list->pprev = &list;
+            }
+            slots[level][index] = nullptr;
+
+            while (list) {
+                Timer* timer = list;
+                unlink(timer);
+                link(timer);
+            }
+
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,97 @@
+#ifndef TOEPLITZ_H
+#define TOEPLITZ_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Toeplitz hash as used by NIC receive-side scaling (Microsoft RSS). The
+// hash of an IPv4 flow is taken over source address, destination address,
+// source port and destination port in network byte order, so a NIC
+// programmed with the same key and indirection table steers a flow to the
+// same queue as software does.
+//
+// The default key repeats 0x6d5a (Woo & Park, "Scalable TCP Session
+// Monitoring with Symmetric Receive-side Scaling"), which makes the hash
+// symmetric: both directions of a flow hash alike. The key is expanded into
+// one 256-entry table per input byte, so a hash costs one lookup per byte.
+class ToeplitzHash {
+public:
+    static const size_t KEY_LENGTH = 40;
+    static const size_t MAX_INPUT_LENGTH = 12; // IPv4 addresses and ports
+
+    ToeplitzHash() {
+        uint8_t symmetric[KEY_LENGTH];
+        for (size_t i = 0; i < KEY_LENGTH; i += 2) {
+            symmetric[i] = 0x6d;
+            symmetric[i + 1] = 0x5a;
+        }
+        set_key(symmetric);
+    }
+
+    explicit ToeplitzHash(const uint8_t* key) {
+        set_key(key);
+    }
+
+    void set_key(const uint8_t* key) {
+        memcpy(secret, key, KEY_LENGTH);
+        for (size_t position = 0; position < MAX_INPUT_LENGTH; position++) {
+            uint32_t windows[8]; // key bits [bit, bit + 32) for each bit of the byte, MSB first
+            for (size_t bit = 0; bit < 8; bit++) {
+                windows[bit] = window(position * 8 + bit);
+            }
+            for (uint32_t value = 0; value < 256; value++) {
+                uint32_t result = 0;
+                for (size_t bit = 0; bit < 8; bit++) {
+                    if (value & (0x80 >> bit)) {
+                        result ^= windows[bit];
+                    }
+                }
+                tables[position][value] = result;
+            }
+        }
+    }
+
+    const uint8_t* get_key() const {
+        return secret;
+    }
+
+    // Hashes up to MAX_INPUT_LENGTH bytes.
+    uint32_t hash(const uint8_t* input, size_t length) const {
+        uint32_t result = 0;
+        for (size_t i = 0; i < length && i < MAX_INPUT_LENGTH; i++) {
+            result ^= tables[i][input[i]];
+        }
+        return result;
+    }
+
+    // Addresses are as for the IPPacket constructor; ports in host order.
+    uint32_t hash_ipv4(uint32_t src_ip, uint32_t dest_ip, uint16_t src_port, uint16_t dest_port) const {
+        return hash_ipv4(src_ip, dest_ip)
+            ^ tables[8][src_port >> 8] ^ tables[9][src_port & 0xFF]
+            ^ tables[10][dest_port >> 8] ^ tables[11][dest_port & 0xFF];
+    }
+
+    uint32_t hash_ipv4(uint32_t src_ip, uint32_t dest_ip) const {
+        return tables[0][src_ip >> 24] ^ tables[1][(src_ip >> 16) & 0xFF]
+            ^ tables[2][(src_ip >> 8) & 0xFF] ^ tables[3][src_ip & 0xFF]
+            ^ tables[4][dest_ip >> 24] ^ tables[5][(dest_ip >> 16) & 0xFF]
+            ^ tables[6][(dest_ip >> 8) & 0xFF] ^ tables[7][dest_ip & 0xFF];
+    }
+
+private:
+    uint8_t secret[KEY_LENGTH];
+    uint32_t tables[MAX_INPUT_LENGTH][256];
+
+    // The 32 key bits starting `bit` bits from the front of the key
+    uint32_t window(size_t bit) const {
+        uint64_t bits = 0;
+        for (size_t i = 0; i < 5; i++) {
+            size_t index = bit / 8 + i;
+            bits = (bits << 8) | (index < KEY_LENGTH ? secret[index] : 0);
+        }
+        return static_cast<uint32_t>(bits >> (8 - bit % 8));
+    }
+};
+
+#endif // TOEPLITZ_H
@@ -4,6 +4,7 @@
 #include <vector>
 #include <cstdint>
 #include <cstring>
+#include "Checksum.h"
 
 class UDPSegment {
 public:
@@ -30,14 +31,51 @@ public:
         return buffer;
     }
 
+    // Serializes with the checksum over the pseudo-header (RFC 768);
+    // addresses are as for the IPPacket constructor.
+    std::vector<uint8_t> serialize(uint32_t src_ip, uint32_t dest_ip) const {
+        std::vector<uint8_t> buffer = serialize();
+        buffer[6] = 0;
+        buffer[7] = 0;
+        uint16_t sum = compute_checksum(buffer.data(), buffer.size(), src_ip, dest_ip);
+        buffer[6] = sum >> 8;
+        buffer[7] = sum & 0xFF;
+        return buffer;
+    }
+
+    // Checksum field value for a serialized datagram whose checksum field is
+    // zero. A computed zero is sent as 0xFFFF, since zero means "none".
+    static uint16_t compute_checksum(const uint8_t* data, size_t length, uint32_t src_ip, uint32_t dest_ip) {
+        uint32_t src = htonl(src_ip);
+        uint32_t dest = htonl(dest_ip);
+        uint32_t sum = Checksum::pseudo_header(reinterpret_cast<const uint8_t*>(&src), reinterpret_cast<const uint8_t*>(&dest), IPPROTO_UDP, static_cast<uint16_t>(length));
+        uint16_t checksum = Checksum::fold(Checksum::add(data, length, sum));
+        return checksum != 0 ? checksum : 0xFFFF;
+    }
+
+    // Over IPv4 a zero checksum field means the sender computed none, and
+    // the datagram is accepted unchecked.
+    static bool verify_checksum(const uint8_t* data, size_t length, uint32_t src_ip, uint32_t dest_ip) {
+        if (length < 8 || (data[6] == 0 && data[7] == 0)) {
+            return length >= 8;
+        }
+        uint32_t src = htonl(src_ip);
+        uint32_t dest = htonl(dest_ip);
+        uint32_t sum = Checksum::pseudo_header(reinterpret_cast<const uint8_t*>(&src), reinterpret_cast<const uint8_t*>(&dest), IPPROTO_UDP, static_cast<uint16_t>(length));
+        return Checksum::fold(Checksum::add(data, length, sum)) == 0;
+    }
+
     static UDPSegment deserialize(const std::vector<uint8_t>& data) {
         uint16_t src_port = (data[0] << 8) | data[1];
         uint16_t dest_port = (data[2] << 8) | data[3];
         uint16_t length = (data[4] << 8) | data[5];
         uint16_t checksum = (data[6] << 8) | data[7];
-        std::vector<uint8_t> payload(data.begin() + 8, data.end());
+        size_t end = length >= 8 && length <= data.size() ? length : data.size();
+        std::vector<uint8_t> payload(data.begin() + 8, data.begin() + end);
 
-        return UDPSegment(ntohs(src_port), ntohs(dest_port), payload);
+        UDPSegment segment(src_port, dest_port, payload);
+        segment.checksum = htons(checksum);
+        return segment;
     }
 };
 
@@ -0,0 +1,345 @@
+#ifndef UDPLAYER_H
+#define UDPLAYER_H
+
+#include "UDP.h"
+#include "Link.h"
+#include "Checksum.h"
+#include "SegmentationOffload.h"
+#include "EventPoller.h"
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+// One datagram as an application sees it: the payload and the remote end.
+// Addresses are as for the IPPacket constructor.
+struct UDPDatagram {
+    uint32_t ip;
+    uint16_t port;
+    std::vector<uint8_t> data;
+};
+
+// UDP over IPv4 for one local address. Bound ports map to endpoints with a
+// bounded receive queue; a datagram arriving at a full queue is dropped, as
+// with a full socket receive buffer. Frames are built in place (Ethernet,
+// IP and UDP headers written straight into one buffer), and a batch of
+// datagrams leaves in a single link burst. A large buffer can be sent as
+// equal datagrams cut from one header template (UDP GSO). An endpoint can
+// publish its readiness to an EventPoller source: always writable, readable
+// while datagrams are queued.
+class UDPLayer {
+public:
+    static const uint16_t EPHEMERAL_PORT_MIN = 49152; // RFC 6335 dynamic range
+    static const uint16_t EPHEMERAL_PORT_MAX = 65535;
+    static const size_t MAX_SEGMENTS = 64; // datagrams per segmented send, as Linux UDP_MAX_SEGMENTS
+
+    UDPLayer(uint32_t local_ip, Link& link, size_t queue_limit = 1024)
+        : local_ip(local_ip),
+        link(link),
+        queue_limit(queue_limit),
+        tx_checksum(true),
+        next_ephemeral(EPHEMERAL_PORT_MIN),
+        datagrams_sent(0),
+        datagrams_received(0),
+        checksum_errors(0),
+        no_port(0),
+        queue_drops(0) {}
+
+    UDPLayer(const UDPLayer&) = delete;
+    UDPLayer& operator=(const UDPLayer&) = delete;
+
+    // Binds `port`, or a free ephemeral port when `port` is 0. Returns the
+    // bound port, or 0 when it is taken.
+    uint16_t bind(uint16_t port) {
+        if (port == 0) {
+            port = find_ephemeral_port();
+            if (port == 0) {
+                return 0;
+            }
+        }
+        std::unique_ptr<Endpoint>& endpoint = endpoints[port];
+        if (endpoint) {
+            return 0;
+        }
+        endpoint.reset(new Endpoint());
+        return port;
+    }
+
+    // Releases the port; queued datagrams are discarded.
+    void unbind(uint16_t port) {
+        endpoints.erase(port);
+    }
+
+    // Keeps `source` up to date with the readiness of the bound port; nullptr detaches it.
+    bool set_poll_source(uint16_t port, EventPoller::Source* source) {
+        auto it = endpoints.find(port);
+        if (it == endpoints.end()) {
+            return false;
+        }
+        it->second->source = source;
+        update_readiness(*it->second);
+        return true;
+    }
+
+    bool is_bound(uint16_t port) const {
+        return endpoints.count(port) != 0;
+    }
+
+    // Without transmit checksums datagrams go out with a zero checksum
+    // field, which IPv4 receivers accept unchecked (like SO_NO_CHECK).
+    void set_tx_checksum(bool enabled) {
+        tx_checksum = enabled;
+    }
+
+    bool send(uint16_t src_port, uint32_t dest_ip, uint16_t dest_port, const uint8_t* data, size_t length) {
+        if (length > MAX_PAYLOAD) {
+            return false;
+        }
+        if (!link.transmit(build_frame(src_port, dest_ip, dest_port, data, length))) {
+            return false;
+        }
+        datagrams_sent++;
+        return true;
+    }
+
+    // Sends the datagrams from `src_port` in one link burst; returns how
+    // many the link accepted.
+    size_t send_batch(uint16_t src_port, const std::vector<UDPDatagram>& datagrams) {
+        batch.clear();
+        for (const auto& datagram : datagrams) {
+            if (datagram.data.size() > MAX_PAYLOAD) {
+                break;
+            }
+            batch.push_back(build_frame(src_port, datagram.ip, datagram.port, datagram.data.data(), datagram.data.size()));
+        }
+        size_t sent = batch.empty() ? 0 : link.transmit_burst(batch);
+        datagrams_sent += sent;
+        return sent;
+    }
+
+    // Sends `length` bytes as datagrams of `segment_size` bytes, the last
+    // possibly shorter, with lengths and checksums patched into copies of
+    // one header template; they leave in one link burst. Returns how many
+    // the link accepted; 0 when the send would exceed MAX_SEGMENTS.
+    size_t send_segmented(uint16_t src_port, uint32_t dest_ip, uint16_t dest_port, const uint8_t* data, size_t length, size_t segment_size) {
+        if (length == 0 || segment_size == 0 || segment_size > MAX_PAYLOAD || (length + segment_size - 1) / segment_size > MAX_SEGMENTS) {
+            return 0;
+        }
+        batch.clear();
+        SegmentationOffload::segment_udp(build_frame(src_port, dest_ip, dest_port, nullptr, 0), data, length, segment_size, batch);
+        size_t sent = link.transmit_burst(batch);
+        datagrams_sent += sent;
+        return sent;
+    }
+
+    // Moves up to `max_datagrams` queued datagrams for `port` to `datagrams`.
+    size_t receive(uint16_t port, std::vector<UDPDatagram>& datagrams, size_t max_datagrams) {
+        auto it = endpoints.find(port);
+        if (it == endpoints.end()) {
+            return 0;
+        }
+        std::deque<UDPDatagram>& queue = it->second->queue;
+        size_t count = 0;
+        while (count < max_datagrams && !queue.empty()) {
+            datagrams.push_back(std::move(queue.front()));
+            queue.pop_front();
+            count++;
+        }
+        if (queue.empty() && count > 0) {
+            update_readiness(*it->second);
+        }
+        return count;
+    }
+
+    size_t pending(uint16_t port) const {
+        auto it = endpoints.find(port);
+        return it != endpoints.end() ? it->second->queue.size() : 0;
+    }
+
+    // Delivers one datagram from (src_ip) to (dest_ip); `udp` is the UDP
+    // header and payload. Returns false if it was dropped.
+    bool receive_datagram(uint32_t src_ip, uint32_t dest_ip, const uint8_t* udp, size_t length) {
+        if (length < 8) {
+            return false;
+        }
+        uint16_t udp_length = get16(udp + 4);
+        if (udp_length < 8 || udp_length > length) {
+            return false;
+        }
+        if (!UDPSegment::verify_checksum(udp, udp_length, src_ip, dest_ip)) {
+            checksum_errors++;
+            return false;
+        }
+        auto it = endpoints.find(get16(udp + 2));
+        if (it == endpoints.end()) {
+            no_port++;
+            return false;
+        }
+        std::deque<UDPDatagram>& queue = it->second->queue;
+        if (queue.size() >= queue_limit) {
+            queue_drops++;
+            return false;
+        }
+        queue.push_back({ src_ip, get16(udp), std::vector<uint8_t>(udp + 8, udp + udp_length) });
+        datagrams_received++;
+        if (queue.size() == 1) {
+            update_readiness(*it->second);
+        }
+        return true;
+    }
+
+    // Consumes one RX burst. UDP datagrams for our address are delivered;
+    // frames that are not IPv4/UDP are moved to `others` untouched.
+    void receive_burst(std::vector<std::vector<uint8_t>>& frames, std::vector<std::vector<uint8_t>>& others) {
+        for (auto& frame : frames) {
+            const size_t ip = ETHERNET_HEADER_LENGTH;
+            if (frame.size() < ip + 28 || get16(&frame[12]) != 0x0800 || (frame[ip] >> 4) != 4 || frame[ip + 9] != IPPROTO_UDP) {
+                others.push_back(std::move(frame));
+                continue;
+            }
+            size_t ip_header_length = (frame[ip] & 0x0F) * 4;
+            size_t total_length = get16(&frame[ip + 2]);
+            if (ip_header_length < 20 || total_length < ip_header_length + 8 || ip + total_length > frame.size()
+                || (get16(&frame[ip + 6]) & 0x3FFF) != 0) {
+                continue; // truncated, or a fragment: reassembly is not supported
+            }
+            if (Checksum::fold(Checksum::add(&frame[ip], ip_header_length)) != 0) {
+                checksum_errors++;
+                continue;
+            }
+            uint32_t dest_ip = get32(&frame[ip + 16]);
+            if (local_ip != 0 && dest_ip != local_ip) {
+                continue;
+            }
+            receive_datagram(get32(&frame[ip + 12]), dest_ip, &frame[ip + ip_header_length], total_length - ip_header_length);
+        }
+    }
+
+    uint32_t get_local_ip() const {
+        return local_ip;
+    }
+
+    uint64_t get_datagrams_sent() const {
+        return datagrams_sent;
+    }
+
+    uint64_t get_datagrams_received() const {
+        return datagrams_received;
+    }
+
+    uint64_t get_checksum_errors() const {
+        return checksum_errors;
+    }
+
+    // Datagrams for a port nobody had bound
+    uint64_t get_no_port() const {
+        return no_port;
+    }
+
+    // Datagrams dropped at a full receive queue
+    uint64_t get_queue_drops() const {
+        return queue_drops;
+    }
+
+private:
+    static const size_t ETHERNET_HEADER_LENGTH = 14;
+    static const size_t HEADER_LENGTH = ETHERNET_HEADER_LENGTH + 20 + 8;
+    static const size_t MAX_PAYLOAD = 65535 - 20 - 8;
+
+    struct Endpoint {
+        std::deque<UDPDatagram> queue;
+        EventPoller::Source* source = nullptr;
+    };
+
+    uint32_t local_ip;
+    Link& link;
+    size_t queue_limit;
+    bool tx_checksum;
+    uint16_t next_ephemeral;
+    std::unordered_map<uint16_t, std::unique_ptr<Endpoint>> endpoints;
+    std::vector<std::vector<uint8_t>> batch;
+    uint64_t datagrams_sent;
+    uint64_t datagrams_received;
+    uint64_t checksum_errors;
+    uint64_t no_port;
+    uint64_t queue_drops;
+    uint8_t dest_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint8_t src_mac[6] = { 0x00, 0x0c, 0x29, 0x36, 0xbc, 0x17 };
+
+    static uint16_t get16(const uint8_t* p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = v >> 8;
+        p[1] = v & 0xFF;
+    }
+
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = (v >> 16) & 0xFF;
+        p[2] = (v >> 8) & 0xFF;
+        p[3] = v & 0xFF;
+    }
+
+    static void update_readiness(Endpoint& endpoint) {
+        if (endpoint.source) {
+            endpoint.source->set_events(EventPoller::WRITABLE | (endpoint.queue.empty() ? 0 : EventPoller::READABLE));
+        }
+    }
+
+    uint16_t find_ephemeral_port() {
+        for (uint32_t tries = 0; tries <= EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN; tries++) {
+            uint16_t port = next_ephemeral;
+            next_ephemeral = port == EPHEMERAL_PORT_MAX ? EPHEMERAL_PORT_MIN : static_cast<uint16_t>(port + 1);
+            if (endpoints.count(port) == 0) {
+                return port;
+            }
+        }
+        return 0;
+    }
+
+    // Same headers as IPPacket (DF set, TTL 64) and EthernetFrame would
+    // produce, written directly into the frame.
+    std::vector<uint8_t> build_frame(uint16_t src_port, uint32_t dest_ip, uint16_t dest_port, const uint8_t* data, size_t length) const {
+        std::vector<uint8_t> frame(HEADER_LENGTH + length);
+        uint8_t* p = frame.data();
+        memcpy(p, dest_mac, 6);
+        memcpy(p + 6, src_mac, 6);
+        put16(p + 12, 0x0800);
+
+        uint8_t* ip = p + ETHERNET_HEADER_LENGTH;
+        ip[0] = 0x45;
+        ip[1] = 0;
+        put16(ip + 2, static_cast<uint16_t>(20 + 8 + length));
+        put16(ip + 4, 0);
+        put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = IPPROTO_UDP;
+        put16(ip + 10, 0);
+        put32(ip + 12, local_ip);
+        put32(ip + 16, dest_ip);
+        put16(ip + 10, Checksum::fold(Checksum::add(ip, 20)));
+
+        uint8_t* udp = ip + 20;
+        put16(udp, src_port);
+        put16(udp + 2, dest_port);
+        put16(udp + 4, static_cast<uint16_t>(8 + length));
+        put16(udp + 6, 0);
+        if (length != 0) {
+            memcpy(udp + 8, data, length);
+        }
+        if (tx_checksum) {
+            put16(udp + 6, UDPSegment::compute_checksum(udp, 8 + length, local_ip, dest_ip));
+        }
+        return frame;
+    }
+};
+
+#endif // UDPLAYER_H